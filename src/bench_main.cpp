@@ -0,0 +1,42 @@
+// std
+#include <iostream>
+#include <string>
+
+// 3rd-party
+#include <easylogging++.h>
+
+// dark utils project
+#include "du_bench.h"
+
+INITIALIZE_EASYLOGGINGPP
+
+using std::cerr;
+using std::endl;
+
+static int showUsage(const std::string& name) {
+    cerr << "Usage: " << endl
+         << "\t" << name << " results.json [--filter name]" << endl
+         << "Runs benchmarks on synthetic data and saves timings as JSON to results.json."
+            " --filter runs only benchmarks whose name contains the given string, e.g. micro/ or duv" << endl;
+    return -1;
+}
+
+int main(int argc, char **argv) {
+    el::Loggers::reconfigureAllLoggers(el::ConfigurationType::Format, "%level %msg");
+    el::Loggers::addFlag(el::LoggingFlag::ColoredTerminalOutput);
+
+    std::string jsonPath, filter;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg(argv[i]);
+        if (arg == "--filter" && i + 1 < argc)
+            filter = argv[++i];
+        else if (arg.rfind("--", 0) != 0 && jsonPath.empty())
+            jsonPath = arg;
+        else
+            return showUsage(argv[0]);
+    }
+    // logs go to stdout, so results can't share it
+    if (jsonPath.empty())
+        return showUsage(argv[0]);
+    return runAllBenchmarks(jsonPath, filter);
+}
@@ -0,0 +1,71 @@
+#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+// Thread-safe FIFO queue with limited capacity, used to connect stages of processing pipelines.
+// push() blocks while the queue is full, pop() blocks while it's empty.
+// After close(), push() refuses new items and pop() returns false once the remaining items are drained.
+template<class T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity_(capacity > 0 ? capacity : 1) {}
+
+    // returns false if the queue has been closed and item was dropped
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        notFull_.wait(lock, [this] {return closed_ || items_.size() < capacity_;});
+        if (closed_)
+            return false;
+        items_.push_back(std::move(item));
+        notEmpty_.notify_one();
+        return true;
+    }
+
+    // returns false if the queue is closed and empty
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        notEmpty_.wait(lock, [this] {return closed_ || !items_.empty();});
+        if (items_.empty())
+            return false;
+        item = std::move(items_.front());
+        items_.pop_front();
+        notFull_.notify_one();
+        return true;
+    }
+
+    // wait for at least one item, then take up to maxItems of those already queued (replacing contents of items).
+    // Returns false if the queue is closed and empty
+    bool popBatch(std::vector<T>& items, size_t maxItems) {
+        items.clear();
+        std::unique_lock<std::mutex> lock(mutex_);
+        notEmpty_.wait(lock, [this] {return closed_ || !items_.empty();});
+        while (!items_.empty() && items.size() < maxItems) {
+            items.push_back(std::move(items_.front()));
+            items_.pop_front();
+        }
+        notFull_.notify_all();
+        return !items.empty();
+    }
+
+    // wake up everyone waiting; no more items will be accepted
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        notFull_.notify_all();
+        notEmpty_.notify_all();
+    }
+
+private:
+    const size_t capacity_;
+    std::deque<T> items_;
+    bool closed_ = false;
+    std::mutex mutex_;
+    std::condition_variable notFull_;
+    std::condition_variable notEmpty_;
+};
+
+#endif // BOUNDED_QUEUE_H
@@ -0,0 +1,158 @@
+#include "box_matching.h"
+#include <algorithm>
+#include <cmath>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+void BoxesSoA::reserve(size_t n) {
+    left.reserve(n);
+    top.reserve(n);
+    right.reserve(n);
+    bottom.reserve(n);
+    area.reserve(n);
+}
+
+void BoxesSoA::push_back(const cv::Rect2d& r) {
+    left.push_back(r.x);
+    top.push_back(r.y);
+    right.push_back(r.x + r.width);
+    bottom.push_back(r.y + r.height);
+    area.push_back(r.area());
+}
+
+// number of box pairs from which it's faster to find overlapping ones with a grid than to compare them all
+constexpr size_t kMinPairsForGrid = 4096;
+
+// iou of box (al, at, ar, ab, aa) with b[j]
+static inline float boxIou(float al, float at, float ar, float ab, float aa, const BoxesSoA& b, size_t j) {
+    float w = std::min(ar, b.right[j]) - std::max(al, b.left[j]);
+    float h = std::min(ab, b.bottom[j]) - std::max(at, b.top[j]);
+    float intersection = (w > 0 && h > 0) ? w * h : 0;
+    return (intersection > 0) ? intersection / (aa + b.area[j] - intersection) : 0;
+}
+
+// iou of box (al, at, ar, ab, aa) with b[j] for j in [begin, end)
+static void iouRowScalar(float al, float at, float ar, float ab, float aa, const BoxesSoA& b,
+                         size_t begin, size_t end, float* out) {
+    for (size_t j = begin; j < end; ++j)
+        out[j] = boxIou(al, at, ar, ab, aa, b, j);
+}
+
+void iouMatrix(const BoxesSoA& a, const BoxesSoA& b, std::vector<float>& ious) {
+    const size_t n = b.size();
+    ious.resize(a.size() * n);
+    for (size_t i = 0; i < a.size(); ++i) {
+        float* row = ious.data() + i * n;
+        size_t j = 0;
+#if defined(__SSE2__)
+        const __m128 al = _mm_set1_ps(a.left[i]), at = _mm_set1_ps(a.top[i]);
+        const __m128 ar = _mm_set1_ps(a.right[i]), ab = _mm_set1_ps(a.bottom[i]);
+        const __m128 aa = _mm_set1_ps(a.area[i]);
+        const __m128 zero = _mm_setzero_ps();
+        for (; j + 4 <= n; j += 4) {
+            __m128 w = _mm_sub_ps(_mm_min_ps(ar, _mm_loadu_ps(&b.right[j])), _mm_max_ps(al, _mm_loadu_ps(&b.left[j])));
+            __m128 h = _mm_sub_ps(_mm_min_ps(ab, _mm_loadu_ps(&b.bottom[j])), _mm_max_ps(at, _mm_loadu_ps(&b.top[j])));
+            __m128 intersection = _mm_mul_ps(_mm_max_ps(w, zero), _mm_max_ps(h, zero));
+            __m128 unionArea = _mm_sub_ps(_mm_add_ps(aa, _mm_loadu_ps(&b.area[j])), intersection);
+            // boxes that don't intersect get 0, also when the union is empty and the division gives NaN
+            __m128 iou = _mm_and_ps(_mm_cmpgt_ps(intersection, zero), _mm_div_ps(intersection, unionArea));
+            _mm_storeu_ps(row + j, iou);
+        }
+#endif
+        iouRowScalar(a.left[i], a.top[i], a.right[i], a.bottom[i], a.area[i], b, j, n, row);
+    }
+}
+
+BoxGrid::BoxGrid(BoxesSoA boxes) : boxes_(std::move(boxes)) {
+    // about one box per cell
+    cellsPerSide_ = std::max(1, std::min(256, int(std::sqrt(double(boxes_.size())))));
+    const size_t numCells = size_t(cellsPerSide_) * cellsPerSide_;
+    // count boxes per cell, then fill; a box covering several cells is in each of them
+    cellStart_.assign(numCells + 1, 0);
+    for (int pass = 0; pass < 2; ++pass) {
+        std::vector<int> fill;
+        if (pass == 1) {
+            for (size_t c = 0; c < numCells; ++c)
+                cellStart_[c + 1] += cellStart_[c];
+            cellBoxes_.resize(cellStart_[numCells]);
+            fill.assign(cellStart_.begin(), cellStart_.end() - 1);
+        }
+        for (size_t i = 0; i < boxes_.size(); ++i) {
+            const int x1 = cellOf(boxes_.right[i]), y1 = cellOf(boxes_.bottom[i]);
+            for (int y = cellOf(boxes_.top[i]); y <= y1; ++y) {
+                for (int x = cellOf(boxes_.left[i]); x <= x1; ++x) {
+                    const size_t c = size_t(y) * cellsPerSide_ + x;
+                    if (pass == 0)
+                        ++cellStart_[c + 1];
+                    else
+                        cellBoxes_[fill[c]++] = i;
+                }
+            }
+        }
+    }
+}
+
+int BoxGrid::cellOf(float coord) const {
+    return std::max(0, std::min(cellsPerSide_ - 1, int(coord * cellsPerSide_)));
+}
+
+void BoxGrid::intersecting(float left, float top, float right, float bottom, std::vector<int>& result) const {
+    result.clear();
+    const float area = (right - left) * (bottom - top);
+    const int x1 = cellOf(right), y1 = cellOf(bottom);
+    for (int y = cellOf(top); y <= y1; ++y) {
+        for (int x = cellOf(left); x <= x1; ++x) {
+            const size_t c = size_t(y) * cellsPerSide_ + x;
+            for (int k = cellStart_[c]; k < cellStart_[c + 1]; ++k) {
+                const int j = cellBoxes_[k];
+                // a pair shares all cells covered by its intersection; take it only in the cell of its top-left corner
+                if (cellOf(std::max(left, boxes_.left[j])) != x || cellOf(std::max(top, boxes_.top[j])) != y)
+                    continue;
+                if (boxIou(left, top, right, bottom, area, boxes_, j) > 0)
+                    result.push_back(j);
+            }
+        }
+    }
+    std::sort(result.begin(), result.end());
+}
+
+std::vector<BoxMatch> overlappingPairs(const BoxesSoA& a, const BoxesSoA& b) {
+    std::vector<BoxMatch> pairs;
+    if (a.size() * b.size() < kMinPairsForGrid) {
+        std::vector<float> ious;
+        iouMatrix(a, b, ious);
+        for (size_t i = 0; i < a.size(); ++i)
+            for (size_t j = 0; j < b.size(); ++j)
+                if (ious[i * b.size() + j] > 0)
+                    pairs.push_back({int(i), int(j), 0, ious[i * b.size() + j]});
+        return pairs;
+    }
+    BoxGrid grid(b);
+    std::vector<int> found;
+    for (size_t i = 0; i < a.size(); ++i) {
+        grid.intersecting(a.left[i], a.top[i], a.right[i], a.bottom[i], found);
+        for (int j: found)
+            pairs.push_back({int(i), j, 0, boxIou(a.left[i], a.top[i], a.right[i], a.bottom[i], a.area[i], b, j)});
+    }
+    return pairs;
+}
+
+std::vector<BoxMatch> greedyOneToOneMatch(std::vector<BoxMatch> candidates, size_t numPreds, size_t numGts) {
+    std::sort(candidates.begin(), candidates.end(), [](const BoxMatch& l, const BoxMatch& r) {
+        if (l.score != r.score)
+            return l.score > r.score;
+        if (l.iou != r.iou)
+            return l.iou > r.iou;
+        return (l.gt != r.gt) ? (l.gt < r.gt) : (l.pred < r.pred);
+    });
+    std::vector<char> predTaken(numPreds, 0), gtTaken(numGts, 0);
+    std::vector<BoxMatch> matches;
+    for (const BoxMatch& c: candidates) {
+        if (predTaken[c.pred] || gtTaken[c.gt])
+            continue;
+        predTaken[c.pred] = gtTaken[c.gt] = 1;
+        matches.push_back(c);
+    }
+    return matches;
+}
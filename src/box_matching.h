@@ -0,0 +1,59 @@
+#ifndef BOX_MATCHING_H
+#define BOX_MATCHING_H
+
+#include <opencv2/opencv.hpp>
+#include <cstddef>
+#include <vector>
+
+// bounding boxes stored as separate arrays of coordinates ("structure of arrays"), so that IoU of one box
+// with many others can be computed several boxes at a time
+struct BoxesSoA {
+    std::vector<float> left, top, right, bottom, area;
+
+    size_t size() const {return left.size();}
+    void reserve(size_t n);
+    void push_back(const cv::Rect2d& r);
+};
+
+// IoU of every box from a with every box from b, row-major: ious[i * b.size() + j] = iou(a[i], b[j]).
+// Uses SSE2 when available; results are the same as intersectionOverUnion up to float rounding
+void iouMatrix(const BoxesSoA& a, const BoxesSoA& b, std::vector<float>& ious);
+
+// Uniform grid over relative boxes (coordinates in [0,1], boxes sticking out fall into the border cells).
+// A box is put into every cell it covers, so a query only looks at boxes nearby. Used on crowded images
+// where most pairs of boxes can't intersect
+class BoxGrid {
+public:
+    explicit BoxGrid(BoxesSoA boxes);
+
+    const BoxesSoA& boxes() const {return boxes_;}
+    // indices of boxes that have an intersection of positive area with the given one, in increasing order
+    void intersecting(float left, float top, float right, float bottom, std::vector<int>& result) const;
+
+private:
+    int cellOf(float coord) const;
+
+    BoxesSoA boxes_;
+    int cellsPerSide_;
+    // boxes in cell c are cellBoxes_[cellStart_[c]] .. cellBoxes_[cellStart_[c + 1] - 1]
+    std::vector<int> cellStart_;
+    std::vector<int> cellBoxes_;
+};
+
+// candidate or accepted pair of prediction and ground truth box
+struct BoxMatch {
+    int pred;
+    int gt;
+    float score; // e.g. probability of the ground truth class in the prediction
+    float iou;
+};
+
+// all pairs of boxes from a and b with iou > 0, sorted by pred (index in a), then by gt (index in b); score is 0.
+// Same pairs and ious as iouMatrix gives, but on crowded images only nearby boxes are compared
+std::vector<BoxMatch> overlappingPairs(const BoxesSoA& a, const BoxesSoA& b);
+
+// one-to-one assignment: pairs are taken in order of decreasing score (then iou), skipping pairs whose prediction
+// or ground truth box is already taken. The result doesn't depend on order of predictions or ground truth boxes
+std::vector<BoxMatch> greedyOneToOneMatch(std::vector<BoxMatch> candidates, size_t numPreds, size_t numGts);
+
+#endif // BOX_MATCHING_H
@@ -2,6 +2,13 @@
 #include "helpers.h"
 #include "cv_funcs.h"
 #include "du_common.h"
+#include "duv_io.h"
+#include "cure_index.h"
+#include "cure_journal.h"
+#include "cure_prefetch.h"
+#include "label_cache.h"
+#include <memory>
+#include <set>
 
 using namespace cv;
 using namespace cvColors;
@@ -9,29 +16,8 @@ constexpr const char* windowName = "cure your dataset";
 constexpr const char* backupFolderPath = "backup_dataset/";
 constexpr int kWindowWidth = 1000;
 constexpr int kWindowHeight = 600;
-
-// returns index of next ComparisonResult to show - "to add" or "to remove"
-// returns -1 if there are no more cmp results to add
-// fixedClass: if fixedClass.first == true, we only return detection of class fixedClass.second
-int nextCmpToShow(const ComparisonResults& cmpResults, bool toAdd, std::pair<bool, int> fixedClass) {
-    int index = -1;
-    for (size_t i = 0; i < cmpResults.size(); ++i) {
-        auto& r = cmpResults[i];
-        if (r.treated || (toAdd && !r.isToAdd()) || (!toAdd && !r.isToRemove())) {
-            continue;
-        } else if (fixedClass.first && fixedClass.second != r.classId) {
-            continue;
-        } else if (index < 0) {
-            index = i;
-        } else {
-            bool isBetter = (toAdd)
-                    ? cmpResults[i].prob > cmpResults[index].prob
-                    : cmpResults[i].bbox.area() > cmpResults[index].bbox.area();
-            index = isBetter ? i : index;
-        }
-    }
-    return index;
-};
+// how many of the upcoming images are prepared in background
+constexpr size_t kNumPrefetchedImages = 8;
 
 // returns image which is not exceeding kWindowWidth * kWindowWidth and aspect ratio is keeped
 static cv::Mat resizedToWindow(cv::Mat img) {
@@ -56,9 +42,30 @@ static cv::Mat resizedToWindow(cv::Mat img) {
     return result;
 }
 
+// Grid over marks of the last looked up .txt file. CureIndex often gives several rows of one crowded image in a row,
+// so the grid is reused until cure moves to another file or edits the marks
+class MarksLookup {
+public:
+    // index of needle in dets (labels of detsPath), or -1
+    int find(const std::string& detsPath, const LoadedDetections& dets, const LoadedDetection& needle) {
+        if (nullptr == grid_ || detsPath != path_) {
+            grid_ = std::make_unique<BoxGrid>(boxesOf(dets));
+            path_ = detsPath;
+        }
+        return findDetection(dets, *grid_, needle);
+    }
+    // must be called when marks of the last file change
+    void invalidate() {grid_.reset();}
+
+private:
+    std::string path_;
+    std::unique_ptr<BoxGrid> grid_;
+};
+
 // pathToTrainData - path to dir with .txt and .jpg files, pathToDuv - /path/to/compareResults.duv
 void cureDataset(const std::string& pathToDuv
-               , const std::string& pathToNames) {
+               , const std::string& pathToNames
+               , const ValidationThresholds& thresholds) {
     bool backupFolderCreated = createFolderIfDoesntExist(backupFolderPath);
     LOG_IF(!backupFolderCreated, ERROR) << "failed to create " << backupFolderPath << ", backups will be omitted";
 
@@ -77,26 +84,51 @@ void cureDataset(const std::string& pathToDuv
         LOG_IF(!savedDuv, ERROR) << "failed to save backup " << backupDuvFilename;
     }
 
+    // apply decisions made in previous sessions that haven't been compacted into .duv yet
+    CureJournal journal(pathToDuv);
+    std::vector<int> erasedRows;
+    journal.replay(cmpResults, erasedRows);
+
     // count toAdd and toRemove indeces; operate with indeces
     size_t numToAdd{0}, numToRemove{0}, numToAddReviewed{0}, numToRemoveReviewed{0}, numTreated{0};
-    for (auto& r: cmpResults) {
+    std::set<int> erasedSet(erasedRows.begin(), erasedRows.end());
+    for (size_t i = 0; i < cmpResults.size(); ++i) {
+        const auto& r = cmpResults[i];
+        if (erasedSet.count(i))
+            continue;
         if (r.treated)
             ++numTreated;
-        if (r.isToAdd())
+        if (r.isToAdd(thresholds))
             ++numToAdd;
-        if (r.isToRemove())
+        if (r.isToRemove(thresholds))
             ++numToRemove;
     }
 
     LOG(INFO) << "Loaded " << cmpResults.size() << " cmpResults in total; "
               << numToAdd << " marks to add and " << numToRemove << " marks to remove. "
-              << numTreated << " treated";
+              << numTreated << " treated (prob threshold " << thresholds.prob << ", IoU threshold " << thresholds.iou
+              << ")";
 
     // show things to add interactively
     bool showingToAdd = true;
-    static const std::set<char> allowedKeysInAddMode =    {'y', 'n', char(27), 's', 'f'}; // accept, no (dont accept), exit, switch, fixclass
-    static const std::set<char> allowedKeysInRemoveMode = {'d', 'k', char(27), 's', 'f'}; // delete, keep (dont delete), exit, switch, fixclass
+    // accept, no (dont accept), exit, switch, fixclass, compact journal into .duv
+    static const std::set<char> allowedKeysInAddMode =    {'y', 'n', char(27), 's', 'f', 'c'};
+    // delete, keep (dont delete), exit, switch, fixclass, compact journal into .duv
+    static const std::set<char> allowedKeysInRemoveMode = {'d', 'k', char(27), 's', 'f', 'c'};
     int key; // key pressed by user
+    auto cureIndex = std::make_unique<CureIndex>(cmpResults, thresholds);
+    for (int row: erasedRows)
+        cureIndex->markErased(row);
+    // images are shown in the order of cureIndex, so the next ones are decoded while user looks at the current one
+    FramePrefetcher prefetcher([](const std::string& path) {
+        cv::Mat img = imread(path);
+        return (nullptr == img.data) ? cv::Mat() : resizedToWindow(img);
+    }, 2 * kNumPrefetchedImages);
+    // label files are read once and written back in background
+    LabelCache labelCache;
+    MarksLookup marksLookup;
+    // decisions replayed from journal may have lost their .txt edits if the previous session crashed
+    journal.reapplyLabelEdits(cmpResults, workPath, labelCache, backupFolderCreated ? backupFolderPath : "");
     cv::namedWindow(windowName, cv::WINDOW_NORMAL);
     cv::resizeWindow(windowName, kWindowWidth, kWindowHeight);
     // in fixclass mode, we only show detections of the same class until they're gone. First = enabled
@@ -104,11 +136,11 @@ void cureDataset(const std::string& pathToDuv
     while (true) {
         LOG(INFO) << "Progress: " << numToAddReviewed << "/" << numToAdd << " to add,"
                      << numToRemoveReviewed << "/" << numToRemove << " to remove";
-        int index = nextCmpToShow(cmpResults, showingToAdd, fixedClass);
+        int index = cureIndex->next(showingToAdd, fixedClass);
 
         // see if we're failed to get next image because this class' images are gone
         if (index < 0 && fixedClass.first) {
-            index = nextCmpToShow(cmpResults, !showingToAdd, std::make_pair(false, 0));
+            index = cureIndex->next(!showingToAdd, std::make_pair(false, 0));
             if (index >= 0) {
                 fixedClass.second = cmpResults[index].classId;
             }
@@ -116,9 +148,13 @@ void cureDataset(const std::string& pathToDuv
 
         // see if we're failed but still have images to delete (or to add, if we were deleting before)
         if (index < 0) {
-            int otherIndex = nextCmpToShow(cmpResults, !showingToAdd, fixedClass);
+            int otherIndex = cureIndex->next(!showingToAdd, fixedClass);
             if (otherIndex < 0) {
                 LOG(INFO) << "Cure procedure finished";
+                labelCache.flush();
+                // nothing decided (or replayed) means nothing to merge, so .duv isn't rewritten
+                if (journal.size() > 0)
+                    journal.compact(cureIndex->remainingResults());
                 break;
             } else {
                 LOG(WARNING) << "No more marks to " << (showingToAdd ? "add":"remove") << ". Switching mode";
@@ -131,23 +167,30 @@ void cureDataset(const std::string& pathToDuv
         auto imgPath = workPath + cr.filename + ".jpg";
         auto detsPath = workPath + cr.filename + ".txt";
         LOG(INFO) << "Next to" << (showingToAdd?"add":"remove") << " is #" << index << ": " << cr.toString();
-        cv::Mat img = imread(imgPath);
-        if (nullptr == img.data) {
+        std::vector<std::string> upcomingImgPaths;
+        for (int upcoming: cureIndex->peek(showingToAdd, fixedClass, kNumPrefetchedImages))
+            upcomingImgPaths.push_back(workPath + cmpResults[upcoming].filename + ".jpg");
+        prefetcher.prefetch(upcomingImgPaths);
+        cv::Mat imgScaled = prefetcher.get(imgPath);
+        if (imgScaled.empty()) {
             LOG(ERROR) << "failed to load image " << imgPath;
             continue;
         }
-        cv::Mat imgScaled = resizedToWindow(img);
-        LoadedDetections dets = loadedDetectionsFromFile(detsPath);
-        const std::string pathToTxtBackup = std::string(backupFolderPath) + "/" + cr.filename + ".txt";
+        LoadedDetections dets = labelCache.get(detsPath);
+        const std::string pathToTxtBackup = backupFolderCreated
+                ? (std::string(backupFolderPath) + "/" + cr.filename + ".txt") : std::string();
         std::string ifFixedString = fixedClass.first ? " [FIXED]" : "";
 
         if (showingToAdd) {
             // see if we've already added this
-            int foundDetIndex = findDetection(dets, cr.toLoadedDet());
+            int foundDetIndex = marksLookup.find(detsPath, dets, cr.toLoadedDet());
             if (foundDetIndex >= 0) {
                 LOG(ERROR) << "Found detection that has already been added to dataset: \""
                     << cr.toString() << "\" is already in file " << detsPath <<". Please re-generate the .duv file"
                     " by running validate command in darkutils.";
+                // nothing to decide here; treated, so that it's not picked again
+                cr.treated = true;
+                journal.record(CureJournal::kTreated, index);
                 continue;
             }
             // the line from top-left corner helps to quickly identify the bbox
@@ -164,34 +207,32 @@ void cureDataset(const std::string& pathToDuv
             } while (allowedKeysInAddMode.find(key) == allowedKeysInAddMode.cend());
             if ('y' == key) {
                 LOG(INFO) << "appending mark " << cr.toLoadedDet().toHumanString() << " to " << detsPath;
-                // save backup
-                if (!ifFileExists(pathToTxtBackup))
-                    saveToFile(pathToTxtBackup, to_string(dets));
-                else
-                    LOG(INFO) << "backup for " << cr.filename << " already exist in " << backupFolderPath << ", dont overwrite.";
-                // add this detection and overwrite original file
+                // add this detection; original file is backed up and overwritten in background
                 dets.push_back(cr.toLoadedDet());
-                saveToFile(detsPath, to_string(dets));
+                labelCache.set(detsPath, dets, pathToTxtBackup);
+                marksLookup.invalidate();
 
                 // mark detection as treated
                 cr.treated = true;
                 cr.iou = 1; // maked = detected -> 100% match
-                saveToFile(pathToDuv, to_string(cmpResults)); // is it really saved?
+                journal.record(CureJournal::kAccepted, index);
                 ++numToAddReviewed;
             } else if ('n' == key) {
                 // mark detection as treated (ignored)
-                LOG(INFO) << "mark ComparisonResult as treated and save .duv";
+                LOG(INFO) << "mark ComparisonResult as treated";
                 cr.treated = true;
-                saveToFile(pathToDuv, to_string(cmpResults));
+                journal.record(CureJournal::kTreated, index);
                 ++numToAddReviewed;
             }
         } else {
             // see if we've already removed
-            int foundDetIndex = findDetection(dets, cr.toLoadedDet());
+            int foundDetIndex = marksLookup.find(detsPath, dets, cr.toLoadedDet());
             if (foundDetIndex < 0) {
                 LOG(ERROR) << "Detection \"" << cr.toString() << "\" from file " << pathToDuv
                     << " was not found in dataset:" << detsPath << ". Please re-generate the .duv file"
                     " by running validate command in darkutils.";
+                cr.treated = true;
+                journal.record(CureJournal::kTreated, index);
                 continue;
             }
             drawBboxCrossed(imgScaled, cr.bbox, colorByClass(cr.classId), 1, 1);
@@ -206,31 +247,40 @@ void cureDataset(const std::string& pathToDuv
                 key = cv::waitKey(0);
             } while (allowedKeysInRemoveMode.find(key) == allowedKeysInRemoveMode.cend());
             if ('d' == key) {
-                // save backup
-                if (!ifFileExists(pathToTxtBackup))
-                    saveToFile(pathToTxtBackup, to_string(dets));
-                else
-                    LOG(INFO) << "backup for " << cr.filename << " already exist in " << backupFolderPath << ", dont overwrite.";
                 LOG(INFO) << "removing detection #" << foundDetIndex << " and saving the remaining "
                     << (dets.size()-1) << " dets to " << detsPath;
-                // delete this detection and overwrite original file
+                // delete this detection; original file is backed up and overwritten in background
+                const int numEqualMarks = countDetections(dets, cr.toLoadedDet());
                 dets.erase(dets.begin() + foundDetIndex);
-                saveToFile(detsPath, to_string(dets));
+                labelCache.set(detsPath, dets, pathToTxtBackup);
+                marksLookup.invalidate();
 
                 // also eliminate from .duv.tsv
-                cmpResults.erase(cmpResults.begin() + index);
-                saveToFile(pathToDuv, to_string(cmpResults));
+                cureIndex->markErased(index);
+                journal.record(CureJournal::kErased, index, numEqualMarks);
                 ++numToRemoveReviewed;
             } else if ('k' == key) {
                 // mark as treated
-                LOG(INFO) << "mark ComparisonResult as treated and save .duv";
+                LOG(INFO) << "mark ComparisonResult as treated";
                 cr.treated = true;
-                saveToFile(pathToDuv, to_string(cmpResults));
+                journal.record(CureJournal::kTreated, index);
                 ++numToRemoveReviewed;
             }
         }
         if (27 == key) {
+            labelCache.flush();
+            if (journal.size() > 0)
+                journal.compact(cureIndex->remainingResults());
             return;
+        } else if ('c' == key) {
+            // erased rows are dropped from .duv, so rows get new indices
+            LOG(INFO) << "saving " << journal.size() << " decisions to " << pathToDuv;
+            labelCache.flush();
+            ComparisonResults remaining = cureIndex->remainingResults();
+            if (journal.compact(remaining)) {
+                cmpResults = std::move(remaining);
+                cureIndex = std::make_unique<CureIndex>(cmpResults, thresholds);
+            }
         } else if ('s' == key) {
             LOG(INFO) << "switching toAdd/toRemove mode."; // TODO stats?
             showingToAdd = !showingToAdd;
@@ -1,12 +1,17 @@
 #ifndef CURE_H
 #define CURE_H
 
+#include "du_common.h"
 #include <string>
 
 // "cure" dataset by interactively showing apparently wrong marks from .duv file
 // @param pathToDuv path to results.duv.tsv, with image paths being either absolute or relative to .duv.tsv
+// Decisions are appended to <pathToDuv>.journal and merged into .duv on exit or when 'c' is pressed
+// Edited label .txt files are written in background every couple of seconds and on exit
+// @param thresholds the ones .duv was made with (see duvThresholds()), they decide which rows are to add or to remove
 void cureDataset(const std::string& pathToDuv
-               , const std::string& pathToNames);
+               , const std::string& pathToNames
+               , const ValidationThresholds& thresholds = ValidationThresholds());
 
 
 #endif // CURE_H
@@ -0,0 +1,62 @@
+#include "cure_index.h"
+
+CureIndex::CureIndex(const ComparisonResults& cmpResults, const ValidationThresholds& thresholds)
+    : cmpResults_(cmpResults), thresholds_(thresholds), erased_(cmpResults.size(), 0) {
+    std::vector<Entry> toAdd, toRemove;
+    for (int i = 0; i < int(cmpResults.size()); ++i) {
+        const ComparisonResult& r = cmpResults[i];
+        if (r.isToAdd(thresholds)) {
+            toAdd.push_back(Entry{r.prob, i});
+            toAddByClass_[r.classId].push(toAdd.back());
+        } else if (r.isToRemove(thresholds)) {
+            toRemove.push_back(Entry{r.bbox.area(), i});
+            toRemoveByClass_[r.classId].push(toRemove.back());
+        }
+    }
+    // heapify all at once rather than pushing one by one
+    toAdd_ = Heap(std::less<Entry>(), std::move(toAdd));
+    toRemove_ = Heap(std::less<Entry>(), std::move(toRemove));
+}
+
+bool CureIndex::isPending(int index, bool toAdd) const {
+    const ComparisonResult& r = cmpResults_[index];
+    return !erased_[index] && (toAdd ? r.isToAdd(thresholds_) : r.isToRemove(thresholds_));
+}
+
+CureIndex::Heap& CureIndex::heap(bool toAdd, std::pair<bool, int> fixedClass) {
+    if (!fixedClass.first)
+        return toAdd ? toAdd_ : toRemove_;
+    // creates empty heap for classes that have no such rows
+    return (toAdd ? toAddByClass_ : toRemoveByClass_)[fixedClass.second];
+}
+
+int CureIndex::next(bool toAdd, std::pair<bool, int> fixedClass) {
+    Heap& h = heap(toAdd, fixedClass);
+    // rows never become pending again, so stale entries can be dropped for good
+    while (!h.empty() && !isPending(h.top().index, toAdd))
+        h.pop();
+    return h.empty() ? -1 : h.top().index;
+}
+
+std::vector<int> CureIndex::peek(bool toAdd, std::pair<bool, int> fixedClass, size_t k) {
+    Heap& h = heap(toAdd, fixedClass);
+    std::vector<Entry> popped;
+    std::vector<int> result;
+    while (result.size() < k && next(toAdd, fixedClass) >= 0) {
+        popped.push_back(h.top());
+        result.push_back(h.top().index);
+        h.pop();
+    }
+    for (const Entry& e: popped)
+        h.push(e);
+    return result;
+}
+
+ComparisonResults CureIndex::remainingResults() const {
+    ComparisonResults results;
+    results.reserve(cmpResults_.size());
+    for (size_t i = 0; i < cmpResults_.size(); ++i)
+        if (!erased_[i])
+            results.push_back(cmpResults_[i]);
+    return results;
+}
@@ -0,0 +1,55 @@
+#ifndef CURE_INDEX_H
+#define CURE_INDEX_H
+
+#include "du_common.h"
+#include <cstdint>
+#include <queue>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Priority queues of .duv rows to review in cure: "to add" rows ordered by prob, "to remove" rows by bbox area,
+// both for all classes and per class. Rows that got treated or erased are not removed from the queues right away;
+// they're skipped when they get on top
+class CureIndex {
+public:
+    // cmpResults must outlive the index; thresholds: the ones .duv was made with, they decide what is to add or remove
+    explicit CureIndex(const ComparisonResults& cmpResults,
+                       const ValidationThresholds& thresholds = ValidationThresholds());
+
+    // returns index of the next ComparisonResult to show - "to add" or "to remove", or -1 if there are none.
+    // fixedClass: if fixedClass.first == true, only detections of class fixedClass.second are considered
+    int next(bool toAdd, std::pair<bool, int> fixedClass);
+    // indices of up to k rows that next() would return one after another if they were all treated,
+    // starting with next() itself
+    std::vector<int> peek(bool toAdd, std::pair<bool, int> fixedClass, size_t k);
+
+    // erased rows stay in cmpResults but are never shown again
+    void markErased(int index) {erased_[index] = 1;}
+    bool isErased(int index) const {return erased_[index] != 0;}
+    // copy of cmpResults without erased rows
+    ComparisonResults remainingResults() const;
+
+private:
+    struct Entry {
+        double key; // prob for "to add", bbox area for "to remove"
+        int index;
+        // on equal keys, the row that goes first in .duv is preferred
+        bool operator<(const Entry& other) const {
+            return key < other.key || (key == other.key && index > other.index);
+        }
+    };
+    typedef std::priority_queue<Entry> Heap;
+
+    Heap& heap(bool toAdd, std::pair<bool, int> fixedClass);
+    // true if row still has to be shown in this mode
+    bool isPending(int index, bool toAdd) const;
+
+    const ComparisonResults& cmpResults_;
+    const ValidationThresholds thresholds_;
+    std::vector<uint8_t> erased_;
+    Heap toAdd_, toRemove_;
+    std::unordered_map<int, Heap> toAddByClass_, toRemoveByClass_;
+};
+
+#endif // CURE_INDEX_H
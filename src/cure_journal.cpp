@@ -0,0 +1,127 @@
+#include "cure_journal.h"
+#include "duv_io.h"
+#include "helpers.h"
+#include "label_cache.h"
+#include "easylogging++.h"
+#include <sstream>
+
+CureJournal::CureJournal(const std::string& pathToDuv)
+    : pathToDuv_(pathToDuv), path_(pathToDuv + ".journal") {}
+
+CureJournal::~CureJournal() {
+    if (nullptr != file_)
+        fclose(file_);
+}
+
+std::string CureJournal::header(size_t numRows) const {
+    uint64_t size = 0;
+    int64_t mtimeNs = 0;
+    getFileSizeAndMtime(pathToDuv_, size, mtimeNs);
+    return "duvjournal " + std::to_string(numRows) + " " + std::to_string(size) + " " + std::to_string(mtimeNs);
+}
+
+size_t CureJournal::replay(ComparisonResults& cmpResults, std::vector<int>& erasedRows) {
+    numRows_ = cmpResults.size();
+    replayedLabelEdits_.clear();
+    std::vector<std::string> lines = getFileContentsAsStringVector(path_, true);
+    if (lines.empty())
+        return 0;
+    if (lines.front() != header(cmpResults.size())) {
+        const std::string stalePath = path_ + ".stale";
+        LOG(WARNING) << path_ << " was made for another version of " << pathToDuv_ << ", moving it to " << stalePath;
+        rename(path_.c_str(), stalePath.c_str());
+        return 0;
+    }
+
+    size_t numReplayed = 0;
+    for (size_t i = 1; i < lines.size(); ++i) {
+        std::istringstream ss(lines[i]);
+        char op;
+        int row;
+        if (!(ss >> op >> row) || row < 0 || row >= int(cmpResults.size())) {
+            LOG(ERROR) << "bad line #" << i << " in " << path_ << ": " << lines[i];
+            continue;
+        }
+        ComparisonResult& r = cmpResults[row];
+        if (kAccepted == op) {
+            r.treated = true;
+            r.iou = 1;
+            replayedLabelEdits_.push_back({kAccepted, row, -1});
+        } else if (kTreated == op) {
+            r.treated = true;
+        } else if (kErased == op) {
+            erasedRows.push_back(row);
+            int numMarks;
+            if (!(ss >> numMarks))
+                numMarks = -1; // written before the count was recorded
+            replayedLabelEdits_.push_back({kErased, row, numMarks});
+        } else {
+            LOG(ERROR) << "unknown operation in line #" << i << " of " << path_ << ": " << lines[i];
+            continue;
+        }
+        ++numReplayed;
+    }
+    numRecords_ = numReplayed;
+    LOG_IF(numReplayed > 0, INFO) << "replayed " << numReplayed << " decisions from " << path_;
+    return numReplayed;
+}
+
+size_t CureJournal::reapplyLabelEdits(const ComparisonResults& cmpResults, const std::string& workPath,
+                                      LabelCache& labels, const std::string& backupDir) const {
+    size_t numReapplied = 0;
+    for (const auto& edit: replayedLabelEdits_) {
+        const ComparisonResult& cr = cmpResults.at(edit.row);
+        const std::string detsPath = workPath + cr.filename + ".txt";
+        LoadedDetections dets = labels.get(detsPath);
+        const int foundDetIndex = findDetection(dets, cr.toLoadedDet());
+        // with duplicate marks, one of them being found doesn't mean the erase was lost
+        const bool eraseLost = foundDetIndex >= 0
+                && (edit.numMarks < 0 || countDetections(dets, cr.toLoadedDet()) == edit.numMarks);
+        if (kAccepted == edit.op && foundDetIndex < 0)
+            dets.push_back(cr.toLoadedDet());
+        else if (kErased == edit.op && eraseLost)
+            dets.erase(dets.begin() + foundDetIndex);
+        else
+            continue;
+        labels.set(detsPath, dets, backupDir.empty() ? std::string() : backupDir + "/" + cr.filename + ".txt");
+        ++numReapplied;
+    }
+    LOG_IF(numReapplied > 0, WARNING) << numReapplied << " label edits from " << path_
+                                      << " were not saved in the previous session, applied them again";
+    return numReapplied;
+}
+
+bool CureJournal::record(Op op, int row, int numMarks) {
+    if (nullptr == file_) {
+        const bool isNew = !ifFileExists(path_);
+        file_ = fopen(path_.c_str(), "a");
+        if (nullptr == file_) {
+            LOG(ERROR) << "can not open journal " << path_;
+            return false;
+        }
+        if (isNew)
+            fprintf(file_, "%s\n", header(numRows_).c_str());
+    }
+    ++numRecords_;
+    const int numWritten = (kErased == op && numMarks >= 0) ? fprintf(file_, "%c %d %d\n", char(op), row, numMarks)
+                                                             : fprintf(file_, "%c %d\n", char(op), row);
+    bool written = numWritten > 0 && 0 == fflush(file_);
+    LOG_IF(!written, ERROR) << "failed to write to journal " << path_;
+    return written;
+}
+
+bool CureJournal::compact(const ComparisonResults& remaining) {
+    if (nullptr != file_) {
+        fclose(file_);
+        file_ = nullptr;
+    }
+    if (!saveComparisonResults(pathToDuv_, remaining)) {
+        LOG(ERROR) << "failed to save " << pathToDuv_ << ", decisions are kept in " << path_;
+        return false;
+    }
+    // .duv is replaced first; if we crash before the journal is removed, its header won't match the new .duv
+    remove(path_.c_str());
+    numRows_ = remaining.size();
+    numRecords_ = 0;
+    return true;
+}
@@ -0,0 +1,68 @@
+#ifndef CURE_JOURNAL_H
+#define CURE_JOURNAL_H
+
+#include "du_common.h"
+#include <cstdio>
+#include <string>
+#include <vector>
+
+class LabelCache;
+
+// Append-only log of decisions made in cure, kept next to .duv as <pathToDuv>.journal, so that a keypress
+// costs one short write instead of rewriting the whole .duv. Decisions are replayed when .duv is loaded
+// and merged into .duv by compact().
+// First line "duvjournal <numRows> <duvSize> <duvMtimeNs>" ties the journal to the .duv it was made for,
+// then each line is "<op> <row>", where row is index of ComparisonResult in .duv as loaded.
+// kErased lines are "d <row> <numMarks>", numMarks being how many equal marks the .txt had before the erase
+class CureJournal {
+public:
+    enum Op : char {
+        kAccepted = 'a', // mark added to dataset: treated, iou = 1
+        kTreated = 't',  // reviewed and left as is
+        kErased = 'd'    // mark deleted from dataset and from .duv
+    };
+
+    explicit CureJournal(const std::string& pathToDuv);
+    ~CureJournal();
+    CureJournal(const CureJournal&) = delete;
+    CureJournal& operator=(const CureJournal&) = delete;
+
+    // Apply decisions from existing journal to cmpResults freshly loaded from .duv; indices of erased rows
+    // are appended to erasedRows. A journal made for another version of .duv is moved aside and ignored.
+    // Returns number of replayed decisions
+    size_t replay(ComparisonResults& cmpResults, std::vector<int>& erasedRows);
+    // Label edits of replayed kAccepted and kErased decisions may not have reached .txt files if the previous session
+    // crashed before LabelCache flushed them, so they're applied again through labels. Marks already added
+    // (or already erased, judging by the number of equal marks left) are left as is, so running it for edits
+    // that were saved changes nothing.
+    // workPath: folder the .duv filenames are relative to; backupDir: where to back up .txt files, empty = no backup.
+    // Returns number of .txt edits made
+    size_t reapplyLabelEdits(const ComparisonResults& cmpResults, const std::string& workPath, LabelCache& labels,
+                             const std::string& backupDir) const;
+    // append decision and flush it to file. numMarks: for kErased, number of marks equal to the erased one
+    // before erasing it, so that the erase is not repeated on a duplicate. Returns false on write error
+    bool record(Op op, int row, int numMarks = -1);
+    // save remaining results to .duv and start a new journal. Returns true if successful
+    bool compact(const ComparisonResults& remaining);
+    // number of decisions recorded since the last compaction
+    size_t size() const {return numRecords_;}
+
+private:
+    // header line for the current state of .duv
+    std::string header(size_t numRows) const;
+
+    std::string pathToDuv_;
+    std::string path_;
+    FILE* file_ = nullptr;
+    size_t numRows_ = 0;
+    size_t numRecords_ = 0;
+    struct LabelEdit {
+        Op op;
+        int row;
+        int numMarks; // -1 if not recorded
+    };
+    // kAccepted and kErased decisions found by replay(), in journal order
+    std::vector<LabelEdit> replayedLabelEdits_;
+};
+
+#endif // CURE_JOURNAL_H
@@ -0,0 +1,73 @@
+#include "cure_prefetch.h"
+
+FramePrefetcher::FramePrefetcher(LoadFunc load, size_t capacity)
+    : load_(std::move(load)), capacity_(std::max<size_t>(1, capacity)), thread_(&FramePrefetcher::run, this) {}
+
+FramePrefetcher::~FramePrefetcher() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    requested_.notify_all();
+    thread_.join();
+}
+
+void FramePrefetcher::prefetch(const std::vector<std::string>& paths) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        requests_.clear();
+        for (const auto& p: paths)
+            if (framesByPath_.end() == framesByPath_.find(p) && p != loading_)
+                requests_.push_back(p);
+    }
+    requested_.notify_one();
+}
+
+cv::Mat FramePrefetcher::get(const std::string& path) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    loaded_.wait(lock, [&] {return loading_ != path;});
+    auto it = framesByPath_.find(path);
+    if (framesByPath_.end() != it) {
+        frames_.splice(frames_.begin(), frames_, it->second);
+        return it->second->second.clone();
+    }
+    lock.unlock();
+    cv::Mat img = load_(path);
+    lock.lock();
+    store(path, img);
+    return img.clone();
+}
+
+void FramePrefetcher::store(const std::string& path, cv::Mat img) {
+    auto it = framesByPath_.find(path);
+    if (framesByPath_.end() != it)
+        frames_.erase(it->second);
+    frames_.emplace_front(path, img);
+    framesByPath_[path] = frames_.begin();
+    while (frames_.size() > capacity_) {
+        framesByPath_.erase(frames_.back().first);
+        frames_.pop_back();
+    }
+}
+
+void FramePrefetcher::run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        requested_.wait(lock, [this] {return stop_ || !requests_.empty();});
+        if (stop_)
+            return;
+        loading_ = requests_.front();
+        requests_.pop_front();
+        if (framesByPath_.end() != framesByPath_.find(loading_)) {
+            loading_.clear();
+            continue;
+        }
+        const std::string path = loading_;
+        lock.unlock();
+        cv::Mat img = load_(path);
+        lock.lock();
+        store(path, img);
+        loading_.clear();
+        loaded_.notify_all();
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef CURE_PREFETCH_H
+#define CURE_PREFETCH_H
+
+#include <opencv2/opencv.hpp>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+// Prepares images for cure (decode and downscale) in a background thread, in the order they're going to be shown.
+// Keeps up to `capacity` prepared images, dropping least recently used ones
+class FramePrefetcher {
+public:
+    // loads image by path and prepares it for showing; returns empty Mat on failure
+    typedef std::function<cv::Mat(const std::string& path)> LoadFunc;
+
+    FramePrefetcher(LoadFunc load, size_t capacity);
+    ~FramePrefetcher();
+    FramePrefetcher(const FramePrefetcher&) = delete;
+    FramePrefetcher& operator=(const FramePrefetcher&) = delete;
+
+    // replace previous requests: load these images in the background, in order
+    void prefetch(const std::vector<std::string>& paths);
+    // returns copy of the prepared image. Waits if it's being prepared right now,
+    // prepares it in the calling thread if it wasn't requested
+    cv::Mat get(const std::string& path);
+
+private:
+    void run();
+    // add prepared image to the cache; mutex_ must be locked
+    void store(const std::string& path, cv::Mat img);
+
+    LoadFunc load_;
+    const size_t capacity_;
+    // most recently used go first
+    std::list<std::pair<std::string, cv::Mat>> frames_;
+    std::unordered_map<std::string, std::list<std::pair<std::string, cv::Mat>>::iterator> framesByPath_;
+    std::deque<std::string> requests_;
+    std::string loading_; // path of image being prepared by background thread
+    bool stop_ = false;
+    std::mutex mutex_;
+    std::condition_variable requested_;
+    std::condition_variable loaded_;
+    std::thread thread_;
+};
+
+#endif // CURE_PREFETCH_H
@@ -2,6 +2,8 @@
 #include <DarkHelp.hpp>
 #include <easylogging++.h>
 #include <string>
+#include <algorithm>
+#include <cstdint>
 
 using namespace cvColors;
 using std::to_string;
@@ -53,8 +55,7 @@ void annotateCustom(cv::Mat& img, const DarkHelp::PredictionResults& results
 
 namespace cvColors {
 cv::Scalar colorByClass(int classId) {
-    // a not-so-elegant method but it works
-    static std::vector<cv::Scalar> palette = {
+    static const cv::Scalar palette[] = {
         CV_RGB(242, 31, 112), // pinkish
         CV_RGB(59, 242, 31), // greenish
         CV_RGB(242, 172, 31), // orange
@@ -63,14 +64,15 @@ cv::Scalar colorByClass(int classId) {
         CV_RGB(31, 56, 242), // blue
         CV_RGB(137, 31, 242) // purple
     };
-    while (classId >= palette.size()) {
-        int r = int(fabsf(sin(classId)*12345678)) % 256;
-        int g = int(fabsf(sin(classId)*1234567)) % 256;
-        int b = int(fabsf(sin(classId)*123456)) % 256;
-        palette.push_back(CV_RGB(r,g,b));
-    }
-
-    return palette[classId];
+    constexpr int kPaletteSize = sizeof(palette) / sizeof(palette[0]);
+    if (classId >= 0 && classId < kPaletteSize)
+        return palette[classId];
+    // other classes get pseudo-random colors computed from classId alone, so the function is safe to call
+    // from many threads and the color of a class doesn't depend on what was drawn before
+    int r = int(fabsf(sin(classId)*12345678)) % 256;
+    int g = int(fabsf(sin(classId)*1234567)) % 256;
+    int b = int(fabsf(sin(classId)*123456)) % 256;
+    return CV_RGB(r,g,b);
 }
 
 }
@@ -84,13 +86,45 @@ float imgDiff(cv::Mat img1, cv::Mat img2) {
     }
     cv::Mat diffImage;
     cv::absdiff(img1, img2, diffImage);
+    // cv::sum is vectorized; same value as averaging per-pixel (b+g+r)/(255*3)
+    const cv::Scalar channelSums = cv::sum(diffImage);
+    const int numChannels = diffImage.channels();
+    double total = 0;
+    for (int c = 0; c < numChannels; ++c)
+        total += channelSums[c];
+    return total / (255. * numChannels * diffImage.rows * diffImage.cols);
+}
 
-    float result = 0;
+cv::Mat similarityThumbnail(const cv::Mat& img) {
+    if (nullptr == img.data)
+        return cv::Mat();
+    cv::Mat small, gray;
+    const int height = std::max(1, img.rows * kSimilarityThumbnailWidth / std::max(1, img.cols));
+    cv::resize(img, small, cv::Size(kSimilarityThumbnailWidth, height), 0, 0, cv::INTER_AREA);
+    if (small.channels() == 1)
+        return small;
+    cv::cvtColor(small, gray, cv::COLOR_BGR2GRAY);
+    return gray;
+}
 
-    for(int j=0; j<diffImage.rows; ++j) {
-        for(int i=0; i<diffImage.cols; ++i) {
-            cv::Vec3b pix = diffImage.at<cv::Vec3b>(j,i);
-            result += float(pix[0] + pix[1] + pix[2]) / (255*3);
-    }   }
-    return result / (diffImage.rows * diffImage.cols);
+float thumbnailDiff(const cv::Mat& thumb1, const cv::Mat& thumb2, float stopAbove) {
+    if (thumb1.size() != thumb2.size() || thumb1.type() != thumb2.type() || nullptr == thumb1.data)
+        return 1;
+    const int rowLength = thumb1.cols * thumb1.channels();
+    const double scale = 255. * rowLength * thumb1.rows;
+    const uint64_t stopSum = uint64_t(std::min(1.f, stopAbove) * scale);
+    uint64_t sum = 0;
+    for (int y = 0; y < thumb1.rows; ++y) {
+        const unsigned char* row1 = thumb1.ptr<unsigned char>(y);
+        const unsigned char* row2 = thumb2.ptr<unsigned char>(y);
+        // plain loop over bytes, vectorized by the compiler
+        uint32_t rowSum = 0;
+        for (int x = 0; x < rowLength; ++x)
+            rowSum += (row1[x] > row2[x]) ? (row1[x] - row2[x]) : (row2[x] - row1[x]);
+        sum += rowSum;
+        // the sum only grows, so the result is already known to be above stopAbove
+        if (sum > stopSum)
+            return sum / scale;
+    }
+    return sum / scale;
 }
@@ -20,7 +20,7 @@ void annotateCustom(cv::Mat& img, const DarkHelp::PredictionResults& results
                     , const std::vector<std::string>& names, bool drawNames, bool drawPercentage);
 
 namespace cvColors {
-// returns color by class index (0 is always pink, 1 is greenish etc.)
+// returns color by class index (0 is always pink, 1 is greenish etc.). Thread-safe
 cv::Scalar colorByClass(int classId);
 
 static const cv::Scalar cvColorWhite =  CV_RGB(255, 255, 255);
@@ -39,6 +39,15 @@ inline cv::Scalar contrastTextColor(const cv::Scalar& bg) {return (bg[0] + bg[1]
 // returns difference between images from 0 (unchanged) to 1 (change from black to white)
 float imgDiff(cv::Mat img1, cv::Mat img2);
 
+// width of thumbnails compared by thumbnailDiff
+constexpr int kSimilarityThumbnailWidth = 160;
+// downscaled grayscale copy of img for fast similarity checks
+cv::Mat similarityThumbnail(const cv::Mat& img);
+// mean absolute difference of two thumbnails, from 0 to 1 like imgDiff (but not equal to it, see calibratesimilarity).
+// Returns as soon as the difference is known to be above stopAbove; the returned value is then above stopAbove
+// but may be less than the full difference
+float thumbnailDiff(const cv::Mat& thumb1, const cv::Mat& thumb2, float stopAbove = 1);
+
 
 
 #endif // CV_FUNCS_H
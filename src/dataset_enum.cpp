@@ -0,0 +1,115 @@
+#include "dataset_enum.h"
+#include <easylogging++.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <unordered_map>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+// getdents64 buffer: a few thousand entries per system call
+constexpr size_t kDirBufferSize = 1 << 20;
+
+std::string_view PathArena::add(std::string_view prefix, std::string_view s) {
+    const size_t size = prefix.size() + s.size();
+    if (size > kBlockSize - usedInLastBlock_) {
+        blocks_.emplace_back(new char[std::max(kBlockSize, size)]);
+        usedInLastBlock_ = 0;
+    }
+    char* dst = blocks_.back().get() + usedInLastBlock_;
+    std::memcpy(dst, prefix.data(), prefix.size());
+    std::memcpy(dst + prefix.size(), s.data(), s.size());
+    usedInLastBlock_ += size;
+    ++numStrings_;
+    return std::string_view(dst, size);
+}
+
+// entry of getdents64 result, see man getdents
+struct LinuxDirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+static bool isDirEntry(int dirFd, const char* name, unsigned char type) {
+    if (DT_UNKNOWN != type)
+        return DT_DIR == type;
+    // some file systems don't fill d_type
+    struct stat st;
+    return fstatat(dirFd, name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+}
+
+bool forEachDirEntry(const std::string& dirPath, const std::function<void(std::string_view name, bool isDir)>& func) {
+    int fd = open(dirPath.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        LOG(ERROR) << "failed to list files in dir " << dirPath;
+        return false;
+    }
+#ifdef __linux__
+    std::unique_ptr<char[]> buf(new char[kDirBufferSize]);
+    for (;;) {
+        const long numBytes = syscall(SYS_getdents64, fd, buf.get(), kDirBufferSize);
+        if (numBytes <= 0) {
+            LOG_IF(numBytes < 0, ERROR) << "failed to read dir " << dirPath << ": " << strerror(errno);
+            break;
+        }
+        for (long pos = 0; pos < numBytes; ) {
+            const LinuxDirent64* entry = reinterpret_cast<const LinuxDirent64*>(buf.get() + pos);
+            pos += entry->d_reclen;
+            if (0 == strcmp(entry->d_name, ".") || 0 == strcmp(entry->d_name, ".."))
+                continue;
+            func(entry->d_name, isDirEntry(fd, entry->d_name, entry->d_type));
+        }
+    }
+    close(fd);
+#else
+    DIR* d = fdopendir(fd);
+    for (struct dirent* entry = readdir(d); nullptr != entry; entry = readdir(d)) {
+        if (0 == strcmp(entry->d_name, ".") || 0 == strcmp(entry->d_name, ".."))
+            continue;
+        func(entry->d_name, isDirEntry(fd, entry->d_name, entry->d_type));
+    }
+    closedir(d);
+#endif
+    return true;
+}
+
+DatasetDirListing listDatasetDir(const std::string& dirPath) {
+    constexpr unsigned char kHasJpg = 1, kHasTxt = 2;
+    static const std::string_view kJpg(".jpg"), kTxt(".txt");
+    DatasetDirListing result;
+    // base name -> kHasJpg | kHasTxt; keys point into the arena
+    std::unordered_map<std::string_view, unsigned char> baseNames;
+    forEachDirEntry(dirPath, [&](std::string_view name, bool isDir) {
+        if (isDir)
+            return;
+        const bool isJpg = name.size() > kJpg.size() && name.substr(name.size() - kJpg.size()) == kJpg;
+        const bool isTxt = name.size() > kTxt.size() && name.substr(name.size() - kTxt.size()) == kTxt;
+        if (!isJpg && !isTxt) {
+            result.otherFiles.push_back(result.arena.add(name));
+            return;
+        }
+        const std::string_view baseName = name.substr(0, name.size() - 4);
+        auto it = baseNames.find(baseName);
+        if (baseNames.end() == it)
+            it = baseNames.emplace(result.arena.add(baseName), 0).first;
+        it->second |= (isJpg ? kHasJpg : kHasTxt);
+    });
+
+    for (const auto& b: baseNames) {
+        if (b.second & kHasJpg)
+            ((b.second & kHasTxt) ? result.labeled : result.unlabeled).push_back(b.first);
+        else
+            result.orphanLabels.push_back(b.first);
+    }
+    for (auto* names: {&result.labeled, &result.unlabeled, &result.orphanLabels, &result.otherFiles})
+        std::sort(names->begin(), names->end());
+    return result;
+}
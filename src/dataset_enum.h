@@ -0,0 +1,45 @@
+#ifndef DATASET_ENUM_H
+#define DATASET_ENUM_H
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Stores many short strings (file names) in large blocks instead of one allocation per string.
+// Views returned by add() stay valid as long as the arena exists, also after it's moved
+class PathArena {
+public:
+    std::string_view add(std::string_view s) {return add(std::string_view(), s);}
+    // stores prefix + s as one string
+    std::string_view add(std::string_view prefix, std::string_view s);
+    size_t size() const {return numStrings_;}
+
+private:
+    static constexpr size_t kBlockSize = 1 << 20;
+    std::vector<std::unique_ptr<char[]>> blocks_;
+    size_t usedInLastBlock_ = kBlockSize;
+    size_t numStrings_ = 0;
+};
+
+// call func(name, isDir) for each entry of dirPath except "." and "..", in directory order.
+// Entries are read in large batches (getdents64 on Linux). Returns false if the folder can't be opened
+bool forEachDirEntry(const std::string& dirPath, const std::function<void(std::string_view name, bool isDir)>& func);
+
+// files of a darknet dataset folder: .jpg images paired with .txt labels of the same base name.
+// All lists are sorted; names point into arena
+struct DatasetDirListing {
+    PathArena arena;
+    // base names (without extension) of images that have .txt and that don't
+    std::vector<std::string_view> labeled, unlabeled;
+    // base names of .txt files without .jpg
+    std::vector<std::string_view> orphanLabels;
+    // full names of all other files (not folders)
+    std::vector<std::string_view> otherFiles;
+};
+
+// list and pair files in one pass over the directory, hashing base names
+DatasetDirListing listDatasetDir(const std::string& dirPath);
+
+#endif // DATASET_ENUM_H
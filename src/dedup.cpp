@@ -0,0 +1,275 @@
+#include "dedup.h"
+#include "dataset_enum.h"
+#include "du_common.h"
+#include "helpers.h"
+#include "parallel.h"
+#include <easylogging++.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <numeric>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+
+// pHash is computed from DCT of kHashImageSide x kHashImageSide image, using kHashBlockSide x kHashBlockSide
+// lowest frequencies
+constexpr int kHashImageSide = 32;
+constexpr int kHashBlockSide = 8;
+// images are hashed in chunks of this size
+constexpr size_t kImagesPerChunk = 64;
+
+uint64_t perceptualHash(const cv::Mat& img) {
+    cv::Mat gray, small, smallFloat, freq;
+    if (img.channels() == 1)
+        gray = img;
+    else
+        cv::cvtColor(img, gray, cv::COLOR_BGR2GRAY);
+    cv::resize(gray, small, cv::Size(kHashImageSide, kHashImageSide), 0, 0, cv::INTER_AREA);
+    small.convertTo(smallFloat, CV_32F);
+    cv::dct(smallFloat, freq);
+
+    float coeffs[kHashBlockSide * kHashBlockSide];
+    for (int y = 0; y < kHashBlockSide; ++y)
+        for (int x = 0; x < kHashBlockSide; ++x)
+            coeffs[y * kHashBlockSide + x] = freq.ptr<float>(y)[x];
+    // DC coefficient is the mean brightness, it doesn't describe the picture
+    coeffs[0] = 0;
+    float sorted[kHashBlockSide * kHashBlockSide];
+    std::copy(std::begin(coeffs), std::end(coeffs), std::begin(sorted));
+    std::nth_element(std::begin(sorted), std::begin(sorted) + 32, std::end(sorted));
+    const float median = sorted[32];
+
+    uint64_t hash = 0;
+    for (int i = 0; i < kHashBlockSide * kHashBlockSide; ++i)
+        hash |= uint64_t(coeffs[i] > median) << i;
+    return hash;
+}
+
+static uint32_t chunkOf(uint64_t hash, int chunk) {
+    return uint32_t(hash >> (16 * chunk)) & 0xFFFF;
+}
+
+MultiIndexHashTable::MultiIndexHashTable(const std::vector<uint64_t>& hashes) : hashes_(hashes) {
+    for (int c = 0; c < kNumChunks; ++c) {
+        // counting sort by chunk value
+        std::vector<uint32_t>& start = bucketStart_[c];
+        start.assign(0x10000 + 1, 0);
+        for (uint64_t h: hashes)
+            ++start[chunkOf(h, c) + 1];
+        std::partial_sum(start.begin(), start.end(), start.begin());
+        std::vector<uint32_t> next(start.begin(), start.end() - 1);
+        ids_[c].resize(hashes.size());
+        for (size_t i = 0; i < hashes.size(); ++i)
+            ids_[c][next[chunkOf(hashes[i], c)]++] = uint32_t(i);
+    }
+}
+
+template<class F>
+void MultiIndexHashTable::forEachInBuckets(int chunk, uint32_t value, int firstBit, int maxFlips, F&& func) const {
+    for (uint32_t i = bucketStart_[chunk][value]; i < bucketStart_[chunk][value + 1]; ++i)
+        func(ids_[chunk][i]);
+    if (maxFlips == 0)
+        return;
+    for (int bit = firstBit; bit < 16; ++bit)
+        forEachInBuckets(chunk, value ^ (1u << bit), bit + 1, maxFlips - 1, func);
+}
+
+void MultiIndexHashTable::find(uint64_t hash, int maxDistance, std::vector<size_t>& ids) const {
+    const int maxChunkDistance = std::min(16, maxDistance / kNumChunks);
+    for (int c = 0; c < kNumChunks; ++c) {
+        forEachInBuckets(c, chunkOf(hash, c), 0, maxChunkDistance, [&](uint32_t id) {
+            if (hammingDistance(hash, hashes_[id]) <= maxDistance)
+                ids.push_back(id);
+        });
+    }
+}
+
+// union-find with path halving
+class DisjointSets {
+public:
+    explicit DisjointSets(size_t size) : parent_(size) {
+        std::iota(parent_.begin(), parent_.end(), 0);
+    }
+    size_t find(size_t i) {
+        while (parent_[i] != i)
+            i = parent_[i] = parent_[parent_[i]];
+        return i;
+    }
+    // the smaller index becomes the root, so each set is named after its first element
+    void unite(size_t a, size_t b) {
+        a = find(a);
+        b = find(b);
+        if (a != b)
+            parent_[std::max(a, b)] = std::min(a, b);
+    }
+
+private:
+    std::vector<size_t> parent_;
+};
+
+std::vector<std::vector<size_t>> findDuplicateClusters(const std::vector<uint64_t>& hashes, int maxDistance) {
+    DisjointSets sets(hashes.size());
+    // equal hashes are joined right away, only distinct ones go to the table
+    std::unordered_map<uint64_t, size_t> firstWithHash;
+    std::vector<uint64_t> distinct;
+    std::vector<size_t> indexOfDistinct;
+    for (size_t i = 0; i < hashes.size(); ++i) {
+        auto inserted = firstWithHash.emplace(hashes[i], i);
+        if (inserted.second) {
+            distinct.push_back(hashes[i]);
+            indexOfDistinct.push_back(i);
+        } else {
+            sets.unite(inserted.first->second, i);
+        }
+    }
+    if (maxDistance > 0) {
+        const MultiIndexHashTable table(distinct);
+        std::vector<size_t> neighbours;
+        for (size_t d = 0; d < distinct.size(); ++d) {
+            neighbours.clear();
+            table.find(distinct[d], maxDistance, neighbours);
+            for (size_t n: neighbours)
+                sets.unite(indexOfDistinct[d], indexOfDistinct[n]);
+        }
+    }
+
+    std::unordered_map<size_t, size_t> clusterOfRoot;
+    std::vector<std::vector<size_t>> clusters;
+    for (size_t i = 0; i < hashes.size(); ++i) {
+        const size_t root = sets.find(i);
+        auto it = clusterOfRoot.emplace(root, clusters.size()).first;
+        if (it->second == clusters.size())
+            clusters.emplace_back();
+        clusters[it->second].push_back(i);
+    }
+    clusters.erase(std::remove_if(clusters.begin(), clusters.end(),
+                                  [](const std::vector<size_t>& c) {return c.size() < 2;}), clusters.end());
+    return clusters;
+}
+
+std::vector<size_t> redundantDuplicates(const std::vector<size_t>& cluster, const std::vector<uint64_t>& hashes,
+                                        int maxDistance) {
+    std::vector<size_t> kept, redundant;
+    for (size_t i: cluster) {
+        const bool nearKept = std::any_of(kept.begin(), kept.end(), [&](size_t k) {
+            return hammingDistance(hashes[k], hashes[i]) <= maxDistance;
+        });
+        (nearKept ? redundant : kept).push_back(i);
+    }
+    return redundant;
+}
+
+// paths to images without .jpg: from train.txt, or all .jpg files in a folder
+static std::vector<std::string> listImages(const std::string& trainTxtOrFolder) {
+    if (!ifFolderExists(trainTxtOrFolder))
+        return loadPathsToImages(trainTxtOrFolder);
+    const std::string folder = addSlash(trainTxtOrFolder);
+    const DatasetDirListing listing = listDatasetDir(folder);
+    std::vector<std::string> result;
+    result.reserve(listing.labeled.size() + listing.unlabeled.size());
+    for (const auto* names: {&listing.labeled, &listing.unlabeled})
+        for (std::string_view name: *names)
+            result.push_back(folder + std::string(name));
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+// rewrite train.txt without lines that refer to removed images
+static bool removeFromTrainTxt(const std::string& pathToTrainTxt, const std::unordered_set<std::string>& removed) {
+    std::string listPath;
+    auto ios = pathToTrainTxt.find_last_of('/');
+    if (std::string::npos != ios)
+        listPath = pathToTrainTxt.substr(0, ios + 1);
+    std::ostringstream kept;
+    for (const std::string& line: getFileContentsAsStringVector(pathToTrainTxt, false)) {
+        const std::string path = strEndsWith(line, ".jpg") ? line.substr(0, line.size() - 4) : line;
+        if (removed.end() == removed.find((!path.empty() && '/' == path.front()) ? path : listPath + path))
+            kept << line << '\n';
+    }
+    return saveToFileAtomic(pathToTrainTxt, kept.str());
+}
+
+int dedupImages(const std::string& trainTxtOrFolder, const std::string& reportFile, int maxDistance,
+                bool remove, unsigned numThreads) {
+    const std::vector<std::string> paths = listImages(trainTxtOrFolder);
+    if (paths.empty()) {
+        LOG(ERROR) << "no images found in " << trainTxtOrFolder;
+        return -1;
+    }
+    LOG(INFO) << "hashing " << paths.size() << " images";
+
+    std::vector<uint64_t> hashes(paths.size());
+    std::vector<char> loaded(paths.size(), 0);
+    std::atomic<size_t> numDone{0};
+    parallelFor(paths.size(), numThreads, kImagesPerChunk, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            // the hash only needs 32x32 pixels, so let the decoder skip most of the work
+            cv::Mat img = cv::imread(paths[i] + ".jpg", cv::IMREAD_REDUCED_GRAYSCALE_4);
+            if (nullptr == img.data) {
+                LOG(ERROR) << "failed to load image " << paths[i] << ".jpg";
+                continue;
+            }
+            hashes[i] = perceptualHash(img);
+            loaded[i] = 1;
+        }
+        const size_t done = (numDone += end - begin);
+        LOG_IF(done / 10000 != (done - (end - begin)) / 10000, INFO) << done << "/" << paths.size() << " images hashed";
+    });
+
+    // images that failed to load are left out
+    std::vector<size_t> indices;
+    std::vector<uint64_t> loadedHashes;
+    for (size_t i = 0; i < paths.size(); ++i) {
+        if (loaded[i]) {
+            indices.push_back(i);
+            loadedHashes.push_back(hashes[i]);
+        }
+    }
+    const std::vector<std::vector<size_t>> clusters = findDuplicateClusters(loadedHashes, maxDistance);
+
+    std::ostringstream report;
+    std::unordered_set<std::string> removed;
+    size_t numDuplicates = 0;
+    for (const std::vector<size_t>& cluster: clusters) {
+        const std::vector<size_t> redundant = redundantDuplicates(cluster, loadedHashes, maxDistance);
+        const char* separator = "";
+        for (size_t c: cluster) {
+            // both are sorted
+            if (!std::binary_search(redundant.begin(), redundant.end(), c)) {
+                report << separator << paths[indices[c]];
+                separator = "\t";
+            }
+        }
+        for (size_t c: redundant) {
+            const std::string& path = paths[indices[c]];
+            report << "\t-" << path;
+            if (!remove)
+                continue;
+            // .txt goes only with its image, otherwise a labeled image would become a negative sample
+            if (0 != std::remove((path + ".jpg").c_str())) {
+                LOG(ERROR) << "failed to remove " << path << ".jpg";
+                continue;
+            }
+            removed.insert(path);
+            std::remove((path + ".txt").c_str());
+        }
+        report << '\n';
+        numDuplicates += redundant.size();
+    }
+    if (!saveToFile(reportFile, report.str())) {
+        LOG(ERROR) << "failed to save report to " << reportFile;
+        return -1;
+    }
+    LOG(INFO) << clusters.size() << " clusters of near-duplicate images, " << numDuplicates
+              << " images could be removed. Clusters saved to " << reportFile;
+    if (remove) {
+        LOG(INFO) << "removed " << removed.size() << " images";
+        if (!removed.empty() && !ifFolderExists(trainTxtOrFolder) && !removeFromTrainTxt(trainTxtOrFolder, removed)) {
+            LOG(ERROR) << "failed to update " << trainTxtOrFolder;
+            return -1;
+        }
+    }
+    return 0;
+}
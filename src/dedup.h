@@ -0,0 +1,61 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// images whose hashes differ in at most this many bits are considered near-duplicates by default
+constexpr int kDefaultDuplicateDistance = 6;
+
+// 64-bit perceptual hash (pHash) of an image: signs of low-frequency DCT coefficients of a 32x32 grayscale copy
+// relative to their median. Similar images have hashes that differ in few bits.
+uint64_t perceptualHash(const cv::Mat& img);
+
+// number of differing bits
+inline int hammingDistance(uint64_t a, uint64_t b) {
+    return __builtin_popcountll(a ^ b);
+}
+
+// multi-index hash table of 64-bit hashes for finding all hashes within given Hamming distance of a query
+// without comparing it with each hash. Hashes are split into kNumChunks 16-bit chunks; if two hashes differ in at
+// most d bits, at least one of their chunks differs in at most d / kNumChunks bits, so only buckets of chunk values
+// that close to the query's ones are checked
+class MultiIndexHashTable {
+public:
+    static constexpr int kNumChunks = 4;
+
+    explicit MultiIndexHashTable(const std::vector<uint64_t>& hashes);
+    // indices of all hashes within maxDistance of hash; the same index may be added more than once
+    void find(uint64_t hash, int maxDistance, std::vector<size_t>& ids) const;
+
+private:
+    // visit ids of all hashes whose chunk differs from value in at most maxFlips of bits [firstBit, 16)
+    template<class F>
+    void forEachInBuckets(int chunk, uint32_t value, int firstBit, int maxFlips, F&& func) const;
+
+    const std::vector<uint64_t>& hashes_;
+    // for each chunk: hash indices sorted by chunk value, and where each value starts (CSR)
+    std::vector<uint32_t> ids_[kNumChunks];
+    std::vector<uint32_t> bucketStart_[kNumChunks];
+};
+
+// groups of indices of hashes that are within maxDistance of each other (transitively).
+// Only groups of 2 or more are returned; indices in each group are sorted, groups are sorted by first index
+std::vector<std::vector<size_t>> findDuplicateClusters(const std::vector<uint64_t>& hashes, int maxDistance);
+
+// members of cluster that can be removed: going in cluster order, an image is kept unless it's within maxDistance
+// of an image kept before it. A chain of small changes (slow pan) is thinned out rather than reduced to one image
+std::vector<size_t> redundantDuplicates(const std::vector<size_t>& cluster, const std::vector<uint64_t>& hashes,
+                                        int maxDistance);
+
+// find near-duplicate images among those listed in train.txt or among .jpg files in a folder.
+// Clusters are saved to reportFile, one per line, tab-separated image paths (without .jpg): images to keep first,
+// then redundant ones (see redundantDuplicates) prefixed with '-'.
+// If remove, redundant images are deleted along with their .txt files (and removed from train.txt).
+// numThreads = 0: all cores. Returns 0 on success
+int dedupImages(const std::string& trainTxtOrFolder, const std::string& reportFile, int maxDistance,
+                bool remove, unsigned numThreads);
+
+#endif // DEDUP_H
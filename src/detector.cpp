@@ -0,0 +1,111 @@
+#include "detector.h"
+#include "helpers.h"
+#include "prediction_store.h"
+#include <easylogging++.h>
+#include <algorithm>
+#include <random>
+
+// DarkHelp has no batched predict, so images of a batch go through the network one by one
+class DarkHelpDetector : public Detector {
+public:
+    DarkHelpDetector(const std::string& configFile, const std::string& weightsFile, const std::string& namesFile,
+                     float threshold)
+        : darkhelp_(configFile, weightsFile, namesFile), configFile_(configFile), weightsFile_(weightsFile) {
+        darkhelp_.threshold                      = threshold;
+        darkhelp_.include_all_names              = false;
+        darkhelp_.names_include_percentage       = true;
+        darkhelp_.annotation_include_duration    = false;
+        darkhelp_.annotation_include_timestamp   = false;
+        darkhelp_.sort_predictions               = DarkHelp::ESort::kAscending;
+    }
+
+    std::vector<DarkHelp::PredictionResults> predictBatch(const std::vector<cv::Mat>& images) override {
+        std::vector<DarkHelp::PredictionResults> results;
+        results.reserve(images.size());
+        for (const cv::Mat& img: images)
+            results.push_back(darkhelp_.predict(img));
+        return results;
+    }
+
+    uint64_t fingerprint() const override {
+        return modelFingerprint(configFile_, weightsFile_);
+    }
+
+private:
+    DarkHelp darkhelp_;
+    std::string configFile_, weightsFile_;
+};
+
+// Up to kMaxMockBoxes boxes per image. Boxes depend only on image size and pixels of its middle row,
+// so the same image always gets the same predictions
+class MockDetector : public Detector {
+public:
+    MockDetector(const std::string& namesFile, float threshold)
+        : names_(getFileContentsAsStringVector(namesFile, true)), threshold_(threshold) {
+        if (names_.empty())
+            names_.push_back("object");
+    }
+
+    std::vector<DarkHelp::PredictionResults> predictBatch(const std::vector<cv::Mat>& images) override {
+        std::vector<DarkHelp::PredictionResults> results;
+        results.reserve(images.size());
+        for (const cv::Mat& img: images)
+            results.push_back(predictOne(img));
+        return results;
+    }
+
+    uint64_t fingerprint() const override {
+        return fnv1aHash(kMockName, sizeof(kMockName));
+    }
+
+private:
+    static constexpr int kMaxMockBoxes = 4;
+    static constexpr char kMockName[] = "darkutils mock detector";
+
+    DarkHelp::PredictionResults predictOne(const cv::Mat& img) const {
+        DarkHelp::PredictionResults results;
+        if (nullptr == img.data || img.rows <= 0 || img.cols <= 0)
+            return results;
+        const int size[2] = {img.rows, img.cols};
+        uint64_t seed = fnv1aHash(size, sizeof(size));
+        seed = fnv1aHash(img.ptr(img.rows / 2), img.cols * img.elemSize(), seed);
+        std::mt19937_64 rng(seed);
+        std::uniform_real_distribution<float> center(0.1, 0.9), side(0.05, 0.3), prob(0.01, 1);
+        for (int numBoxes = rng() % (kMaxMockBoxes + 1); numBoxes > 0; --numBoxes) {
+            DarkHelp::PredictionResult p;
+            p.best_class = int(rng() % names_.size());
+            p.best_probability = prob(rng);
+            p.original_point = cv::Point2f(center(rng), center(rng));
+            p.original_size = cv::Size2f(side(rng), side(rng));
+            if (p.best_probability < threshold_)
+                continue;
+            p.all_probabilities[p.best_class] = p.best_probability;
+            p.rect = cv::Rect(int((p.original_point.x - p.original_size.width / 2) * img.cols),
+                              int((p.original_point.y - p.original_size.height / 2) * img.rows),
+                              int(p.original_size.width * img.cols), int(p.original_size.height * img.rows));
+            p.name = names_[p.best_class];
+            results.push_back(p);
+        }
+        return results;
+    }
+
+    std::vector<std::string> names_;
+    float threshold_;
+};
+
+bool detectorBackendFromString(const std::string& name, DetectorBackend& backend) {
+    if (name == "darkhelp")
+        backend = DetectorBackend::kDarkHelp;
+    else if (name == "mock")
+        backend = DetectorBackend::kMock;
+    else
+        return false;
+    return true;
+}
+
+std::unique_ptr<Detector> createDetector(DetectorBackend backend, const std::string& configFile,
+                                         const std::string& weightsFile, const std::string& namesFile, float threshold) {
+    if (DetectorBackend::kMock == backend)
+        return std::unique_ptr<Detector>(new MockDetector(namesFile, threshold));
+    return std::unique_ptr<Detector>(new DarkHelpDetector(configFile, weightsFile, namesFile, threshold));
+}
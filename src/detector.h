@@ -0,0 +1,40 @@
+#ifndef DETECTOR_H
+#define DETECTOR_H
+
+#include <DarkHelp.hpp>
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// what makes predictions: the network via DarkHelp, or a mock that makes up deterministic boxes without any weights
+// (to benchmark and test everything around inference)
+enum class DetectorBackend {kDarkHelp, kMock};
+
+// "darkhelp" or "mock"; returns false for unknown names
+bool detectorBackendFromString(const std::string& name, DetectorBackend& backend);
+
+// how commands run inference, set by --backend and --batch options
+struct DetectorOptions {
+    DetectorBackend backend = DetectorBackend::kDarkHelp;
+    // images passed to predictBatch at once. The DarkHelp backend predicts them one by one anyway
+    unsigned batchSize = 1;
+};
+
+class Detector {
+public:
+    virtual ~Detector() = default;
+    // predictions for each image, in the same order
+    virtual std::vector<DarkHelp::PredictionResults> predictBatch(const std::vector<cv::Mat>& images) = 0;
+    // identifies the model for prediction caches: hash of .cfg and .weights, or a constant for the mock
+    virtual uint64_t fingerprint() const = 0;
+
+    DarkHelp::PredictionResults predict(const cv::Mat& image) {return predictBatch({image}).front();}
+};
+
+// threshold: predictions with lower probability are dropped
+std::unique_ptr<Detector> createDetector(DetectorBackend backend, const std::string& configFile,
+                                         const std::string& weightsFile, const std::string& namesFile, float threshold);
+
+#endif // DETECTOR_H
@@ -0,0 +1,597 @@
+#include "du_bench.h"
+#include "du_common.h"
+#include "duv_io.h"
+#include "validation.h"
+#include "cv_funcs.h"
+#include "dedup.h"
+#include "dataset_enum.h"
+#include "helpers.h"
+#include "detector.h"
+#include "easylogging++.h"
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <unistd.h>
+#include <dirent.h>
+#include <functional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// repeat function several times and return the best wall time in milliseconds
+static double bestTimeMs(const std::function<void()>& func, int repeats = 3) {
+    double best = 0;
+    for (int i = 0; i < repeats; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        func();
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        best = (i == 0) ? ms : std::min(best, ms);
+    }
+    return best;
+}
+
+// timings of all benchmarks, saved as JSON to compare between releases
+class BenchReport {
+public:
+    // time func as bestTimeMs does and record it under name; numOps is how many items func processes
+    double measure(const std::string& name, size_t numOps, const std::function<void()>& func, int repeats = 3) {
+        const double ms = bestTimeMs(func, repeats);
+        entries_.push_back({name, ms, numOps});
+        return ms;
+    }
+
+    std::string toJson() const {
+        std::ostringstream ss;
+        ss << "{\n  \"date\": \"" << currentDateString("%Y-%m-%d %H:%M:%S") << "\",\n"
+           << "  \"hardware_threads\": " << std::thread::hardware_concurrency() << ",\n"
+           << "  \"benchmarks\": [";
+        for (size_t i = 0; i < entries_.size(); ++i) {
+            const Entry& e = entries_[i];
+            ss << (i == 0 ? "\n" : ",\n") << "    {\"name\": \"" << e.name << "\", \"best_ms\": " << e.ms
+               << ", \"ops\": " << e.numOps << ", \"ns_per_op\": " << (e.numOps > 0 ? e.ms * 1e6 / e.numOps : 0) << "}";
+        }
+        ss << "\n  ]\n}\n";
+        return ss.str();
+    }
+
+private:
+    struct Entry {
+        std::string name; // group/benchmark/variant, no quotes or backslashes
+        double ms;
+        size_t numOps;
+    };
+    std::vector<Entry> entries_;
+};
+
+// deterministic pseudo-random results, a few rows per image
+static ComparisonResults syntheticComparisonResults(size_t numRows) {
+    std::mt19937 rng(12345);
+    std::uniform_real_distribution<float> coord(0, 0.8), size(0.01, 0.2), prob(0, 1);
+    ComparisonResults results(numRows);
+    for (size_t i = 0; i < numRows; ++i) {
+        auto& r = results[i];
+        r.classId = rng() % 10;
+        r.bbox = cv::Rect2d(coord(rng), coord(rng), size(rng), size(rng));
+        r.prob = prob(rng);
+        r.iou = prob(rng);
+        r.filename = "dataset/images/img" + leadingZeros(i / 4, 7);
+        r.treated = (rng() % 8 == 0);
+    }
+    return results;
+}
+
+// .duv parsing: per-line ComparisonResult::fromString vs in-place parseDuvBuffer
+static int runDuvParsingBenchmark(BenchReport& report) {
+    constexpr size_t kNumRows = 1000000;
+    const std::string duv = to_string(syntheticComparisonResults(kNumRows));
+
+    size_t numParsedOld = 0, numParsedNew = 0;
+    double oldMs = report.measure("macro/duv_parse/fromString", kNumRows, [&] {
+        ComparisonResults rs;
+        std::istringstream ss(duv);
+        for (std::string line; std::getline(ss, line); ) {
+            ComparisonResult r = ComparisonResult::fromString(line);
+            if (r.isValid())
+                rs.push_back(r);
+        }
+        numParsedOld = rs.size();
+    });
+    double newMs = report.measure("macro/duv_parse/parseDuvBuffer", kNumRows, [&] {
+        ComparisonResults rs;
+        rs.reserve(duv.size() / 48);
+        parseDuvBuffer(duv, rs, false, "synthetic .duv");
+        numParsedNew = rs.size();
+    });
+    LOG(INFO) << "parse " << kNumRows << " .duv rows (" << (duv.size() >> 20) << " MB): fromString " << oldMs
+              << " ms, parseDuvBuffer " << newMs << " ms (x" << (oldMs / newMs) << ")";
+    if (numParsedOld != kNumRows || numParsedNew != kNumRows) {
+        LOG(ERROR) << "parsed " << numParsedOld << " and " << numParsedNew << " rows instead of " << kNumRows;
+        return -1;
+    }
+    return 0;
+}
+
+// label loading: loadedDetectionsFromFile per image vs loadDatasetLabels, over small files in temporary folder
+static int runLabelLoadingBenchmark(BenchReport& report) {
+    constexpr size_t kNumFiles = 20000;
+    char dirTemplate[] = "/tmp/darkutils_bench_XXXXXX";
+    if (nullptr == mkdtemp(dirTemplate)) {
+        LOG(ERROR) << "can not create temporary folder for label files";
+        return -1;
+    }
+    const std::string dir = addSlash(dirTemplate);
+    std::mt19937 rng(12345);
+    std::vector<std::string> paths;
+    for (size_t i = 0; i < kNumFiles; ++i) {
+        LoadedDetections dets;
+        for (size_t j = rng() % 8; j > 0; --j)
+            dets.push_back(LoadedDetection{int(rng() % 10), cv::Rect2d(0.1 + j * 0.05, 0.2, 0.1, 0.15), ""});
+        paths.push_back(dir + leadingZeros(i, 6));
+        saveToFile(paths.back() + ".txt", to_string(dets));
+    }
+
+    size_t numOld = 0, numNew = 0;
+    double oldMs = report.measure("macro/label_loading/loadedDetectionsFromFile", kNumFiles, [&] {
+        numOld = 0;
+        for (const auto& p: paths)
+            numOld += loadedDetectionsFromFile(p + ".txt").size();
+    });
+    double newMs = report.measure("macro/label_loading/loadDatasetLabels", kNumFiles, [&] {
+        numNew = loadDatasetLabels(paths).boxes.size();
+    });
+    for (const auto& p: paths)
+        remove((p + ".txt").c_str());
+    rmdir(dir.c_str());
+
+    LOG(INFO) << "load " << kNumFiles << " label files: loadedDetectionsFromFile " << oldMs
+              << " ms, loadDatasetLabels " << newMs << " ms (x" << (oldMs / newMs) << ")";
+    if (numOld != numNew) {
+        LOG(ERROR) << "loaded " << numOld << " and " << numNew << " boxes";
+        return -1;
+    }
+    return 0;
+}
+
+// comparePredictions as it was before the iou matrix: scalar iou in nested loops, first match wins
+static ComparisonResults comparePredictionsByScan(const DarkHelp::PredictionResults& predictions,
+                                                  const LoadedDetections& groundTruthDets, const std::string& filename) {
+    ComparisonResults results;
+    for (const LoadedDetection& loadedDet: groundTruthDets) {
+        bool detected = false;
+        for (const auto& prediction: predictions) {
+            auto predictionBbox = relativeBbox(prediction);
+            float p = getProb(prediction, loadedDet.classId);
+            float iou = intersectionOverUnion(predictionBbox, loadedDet.bbox);
+            if (p > kValidationProbThresh && iou > kStrongIntersectionThresh) {
+                results.push_back({loadedDet.classId, predictionBbox, p, iou, filename});
+                detected = true;
+                break;
+            }
+        }
+        if (!detected)
+            results.push_back({loadedDet.classId, loadedDet.bbox, 0, 0, filename});
+    }
+    for (const auto& prediction: predictions) {
+        for (const auto& classProb: prediction.all_probabilities) {
+            if (classProb.second <= kValidationProbThresh)
+                continue;
+            auto predictionBbox = relativeBbox(prediction);
+            float maxClassIou = 0;
+            for (const LoadedDetection& loadedDet: groundTruthDets) {
+                if (classProb.first == loadedDet.classId) {
+                    maxClassIou = std::max(maxClassIou, intersectionOverUnion(predictionBbox, loadedDet.bbox));
+                    if (maxClassIou >= kStrongIntersectionThresh)
+                        break;
+                }
+            }
+            if (maxClassIou < kStrongIntersectionThresh)
+                results.push_back({classProb.first, predictionBbox, classProb.second, maxClassIou, filename});
+        }
+    }
+    return results;
+}
+
+// comparing predictions with marks: nested loops vs overlapping pairs (iou matrix or grid) with one-to-one matching
+static int runComparePredictionsBenchmark(BenchReport& report, size_t numImages, size_t numMarks) {
+    constexpr size_t kNumClasses = 5;
+    // the more marks, the smaller they are
+    const float maxSize = 1.f / std::sqrt(float(numMarks));
+    std::mt19937 rng(12345);
+    std::uniform_real_distribution<float> coord(0, 1 - maxSize), size(maxSize / 5, maxSize), prob(0.2, 1);
+    std::uniform_real_distribution<float> jitter(-maxSize / 10, maxSize / 10);
+    std::vector<LoadedDetections> marks(numImages);
+    std::vector<DarkHelp::PredictionResults> predictions(numImages);
+    for (size_t i = 0; i < numImages; ++i) {
+        for (size_t m = 0; m < numMarks; ++m) {
+            marks[i].push_back(LoadedDetection{int(rng() % kNumClasses),
+                                               cv::Rect2d(coord(rng), coord(rng), size(rng), size(rng)), ""});
+            // most marks are detected, some twice, some predictions are somewhere else
+            for (size_t copies = (rng() % 8 == 0) ? 0 : 1 + (rng() % 4 == 0); copies > 0; --copies) {
+                const cv::Rect2d& b = (rng() % 10 == 0) ? cv::Rect2d(coord(rng), coord(rng), maxSize, maxSize) : marks[i].back().bbox;
+                DarkHelp::PredictionResult p;
+                p.original_point = cv::Point2f(b.x + b.width / 2 + jitter(rng), b.y + b.height / 2 + jitter(rng));
+                p.original_size = cv::Size2f(b.width, b.height);
+                p.best_class = (rng() % 10 == 0) ? int(rng() % kNumClasses) : marks[i].back().classId;
+                p.best_probability = prob(rng);
+                p.all_probabilities[p.best_class] = p.best_probability;
+                p.all_probabilities[(p.best_class + 1) % kNumClasses] = prob(rng) / 4;
+                predictions[i].push_back(p);
+            }
+        }
+    }
+
+    const std::string name = "macro/compare_predictions/" + std::to_string(numImages) + "x" + std::to_string(numMarks);
+    size_t numOld = 0, numNew = 0;
+    double oldMs = report.measure(name + "/nested_loops", numImages, [&] {
+        numOld = 0;
+        for (size_t i = 0; i < numImages; ++i)
+            numOld += comparePredictionsByScan(predictions[i], marks[i], "img").size();
+    });
+    double newMs = report.measure(name + "/comparePredictions", numImages, [&] {
+        numNew = 0;
+        for (size_t i = 0; i < numImages; ++i)
+            numNew += comparePredictions(predictions[i], marks[i], "img").size();
+    });
+    LOG(INFO) << "compare predictions on " << numImages << " images with " << numMarks << " marks: nested loops "
+              << oldMs << " ms, comparePredictions " << newMs << " ms (x" << (oldMs / newMs) << ")";
+    // both report every mark once and the same false positives; only matched predictions may differ
+    if (numOld != numNew) {
+        LOG(ERROR) << "got " << numOld << " and " << numNew << " comparison results";
+        return -1;
+    }
+    return 0;
+}
+
+// imgDiff as it was: per-pixel loop over absdiff of 3-channel images
+static float imgDiffByPixelLoop(const cv::Mat& img1, const cv::Mat& img2) {
+    cv::Mat diffImage;
+    cv::absdiff(img1, img2, diffImage);
+    double sum = 0;
+    for (int j = 0; j < diffImage.rows; ++j) {
+        for (int i = 0; i < diffImage.cols; ++i) {
+            const cv::Vec3b& pix = diffImage.at<cv::Vec3b>(j, i);
+            sum += (pix[0] + pix[1] + pix[2]) / (255. * 3);
+        }
+    }
+    return sum / (diffImage.rows * diffImage.cols);
+}
+
+// similarity of consecutive 720p frames: per-pixel loop vs imgDiff vs thumbnails (incl. making them)
+static int runImgDiffBenchmark(BenchReport& report) {
+    constexpr int kNumFrames = 10;
+    std::mt19937 rng(12345);
+    std::vector<cv::Mat> frames;
+    for (int f = 0; f < kNumFrames; ++f) {
+        frames.emplace_back(720, 1280, CV_8UC3);
+        for (int y = 0; y < frames.back().rows; ++y) {
+            unsigned char* row = frames.back().ptr<unsigned char>(y);
+            for (int x = 0; x < frames.back().cols * 3; ++x)
+                row[x] = (f == 0 || rng() % 16 == 0) ? (unsigned char)(rng()) : frames[f-1].ptr<unsigned char>(y)[x];
+        }
+    }
+    std::vector<float> oldDiffs(kNumFrames), newDiffs(kNumFrames), thumbDiffs(kNumFrames);
+    double oldMs = report.measure("micro/img_diff/per_pixel_loop", kNumFrames - 1, [&] {
+        for (int f = 1; f < kNumFrames; ++f)
+            oldDiffs[f] = imgDiffByPixelLoop(frames[f-1], frames[f]);
+    });
+    double newMs = report.measure("micro/img_diff/imgDiff", kNumFrames - 1, [&] {
+        for (int f = 1; f < kNumFrames; ++f)
+            newDiffs[f] = imgDiff(frames[f-1], frames[f]);
+    });
+    double thumbMs = report.measure("micro/img_diff/thumbnails", kNumFrames - 1, [&] {
+        cv::Mat prevThumb = similarityThumbnail(frames[0]);
+        for (int f = 1; f < kNumFrames; ++f) {
+            cv::Mat thumb = similarityThumbnail(frames[f]);
+            thumbDiffs[f] = thumbnailDiff(prevThumb, thumb);
+            prevThumb = thumb;
+        }
+    });
+    LOG(INFO) << "similarity of " << (kNumFrames - 1) << " pairs of 720p frames: per-pixel loop " << oldMs
+              << " ms, imgDiff " << newMs << " ms (x" << (oldMs / newMs) << "), thumbnails " << thumbMs
+              << " ms (x" << (oldMs / thumbMs) << ")";
+    for (int f = 1; f < kNumFrames; ++f) {
+        if (std::abs(oldDiffs[f] - newDiffs[f]) > 1e-4) {
+            LOG(ERROR) << "imgDiff changed: " << oldDiffs[f] << " vs " << newDiffs[f];
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// near-duplicate search among image hashes: all pairs vs multi-index hash table
+static int runDedupBenchmark(BenchReport& report) {
+    constexpr size_t kNumHashes = 20000;
+    constexpr int kDistance = kDefaultDuplicateDistance;
+    std::mt19937_64 rng(12345);
+    std::vector<uint64_t> hashes(kNumHashes);
+    // most images are unique, every 10th is a slightly changed copy of an earlier one
+    for (size_t i = 0; i < kNumHashes; ++i) {
+        hashes[i] = (i > 0 && i % 10 == 0) ? hashes[rng() % i] ^ (uint64_t(1) << (rng() % 64)) : rng();
+    }
+    size_t numPairs = 0, numClusters = 0;
+    double allPairsMs = report.measure("macro/dedup/all_pairs", kNumHashes, [&] {
+        numPairs = 0;
+        for (size_t i = 0; i < kNumHashes; ++i)
+            for (size_t j = 0; j < i; ++j)
+                numPairs += (hammingDistance(hashes[i], hashes[j]) <= kDistance);
+    }, 1);
+    double treeMs = report.measure("macro/dedup/findDuplicateClusters", kNumHashes, [&] {
+        numClusters = findDuplicateClusters(hashes, kDistance).size();
+    });
+    LOG(INFO) << "near-duplicates among " << kNumHashes << " hashes: all pairs " << allPairsMs << " ms ("
+              << numPairs << " pairs), multi-index clusters " << treeMs << " ms (" << numClusters << " clusters, x"
+              << (allPairsMs / treeMs) << ")";
+    return 0;
+}
+
+// loadTrainImageFilenames as it was: readdir into strings, sort, pair neighbours by base name
+static std::vector<std::string> loadTrainImageFilenamesBySort(const std::string& path) {
+    std::vector<std::string> filesList;
+    DIR* d = opendir(path.c_str());
+    for (struct dirent* dir = readdir(d); nullptr != dir; dir = readdir(d)) {
+        std::string filename(dir->d_name);
+        if (filename != "." && filename != "..")
+            filesList.push_back(filename);
+    }
+    closedir(d);
+    std::vector<std::string> result;
+    std::sort(filesList.begin(), filesList.end());
+    for (size_t i = 0; i + 1 < filesList.size(); ++i) {
+        if (std::string::npos == filesList[i].rfind(".jpg"))
+            continue;
+        std::string baseFileName = getBaseFileName(filesList[i]);
+        bool txtFileExists = false;
+        for (size_t t = i; !txtFileExists && t < filesList.size() && baseFileName == getBaseFileName(filesList[t]); ++t)
+            txtFileExists |= (baseFileName + ".txt" == filesList[t]);
+        if (txtFileExists)
+            result.push_back(baseFileName);
+    }
+    return result;
+}
+
+// listing a dataset folder: sort & scan vs getdents with hashing
+static int runDatasetEnumBenchmark(BenchReport& report) {
+    constexpr size_t kNumImages = 20000;
+    char dirTemplate[] = "/tmp/darkutils_bench_XXXXXX";
+    if (nullptr == mkdtemp(dirTemplate)) {
+        LOG(ERROR) << "failed to create temporary folder";
+        return -1;
+    }
+    const std::string dir = std::string(dirTemplate) + "/";
+    std::vector<std::string> files;
+    for (size_t i = 0; i < kNumImages; ++i) {
+        const std::string name = "frame_" + leadingZeros(int((i * 7919) % kNumImages), 6);
+        files.push_back(dir + name + ".jpg");
+        if (i % 10 != 0)
+            files.push_back(dir + name + ".txt");
+    }
+    for (const std::string& f: files)
+        saveToFile(f, "");
+
+    std::vector<std::string> oldResult, newResult;
+    double oldMs = report.measure("macro/dataset_listing/readdir_and_sort", files.size(), [&] {
+        oldResult = loadTrainImageFilenamesBySort(dir);
+    });
+    double newMs = report.measure("macro/dataset_listing/loadTrainImageFilenames", files.size(), [&] {
+        newResult = loadTrainImageFilenames(dir);
+    });
+    for (const std::string& f: files)
+        remove(f.c_str());
+    rmdir(dirTemplate);
+    LOG(INFO) << "listing " << files.size() << " dataset files: readdir & sort " << oldMs << " ms, "
+              << "loadTrainImageFilenames " << newMs << " ms (x" << (oldMs / newMs) << ")";
+    if (oldResult != newResult) {
+        LOG(ERROR) << "got " << oldResult.size() << " and " << newResult.size() << " labeled images";
+        return -1;
+    }
+    return 0;
+}
+
+// whole validate pipeline (decode, cache check, compare, write) with the mock detector instead of the network,
+// feeding it one image at a time vs batches
+static int runMockValidationBenchmark(BenchReport& report) {
+    constexpr int kNumImages = 200;
+    char dirTemplate[] = "/tmp/darkutils_bench_XXXXXX";
+    if (nullptr == mkdtemp(dirTemplate)) {
+        LOG(ERROR) << "failed to create temporary folder";
+        return -1;
+    }
+    const std::string dir = std::string(dirTemplate) + "/";
+    std::vector<std::string> files;
+    std::string trainTxt;
+    for (int i = 0; i < kNumImages; ++i) {
+        const std::string name = "img_" + leadingZeros(i, 4);
+        cv::Mat img(240, 320, CV_8UC3);
+        for (int y = 0; y < img.rows; ++y) {
+            unsigned char* row = img.ptr<unsigned char>(y);
+            for (int x = 0; x < img.cols * 3; ++x)
+                row[x] = (unsigned char)(x + y + 37 * i);
+        }
+        cv::imwrite(dir + name + ".jpg", img);
+        saveToFile(dir + name + ".txt", "0 0.5 0.5 0.2 0.3\n1 0.25 0.3 0.1 0.1\n");
+        files.push_back(dir + name + ".jpg");
+        files.push_back(dir + name + ".txt");
+        trainTxt += name + ".jpg\n";
+    }
+    files.push_back(dir + "train.txt");
+    saveToFile(files.back(), trainTxt);
+
+    std::vector<size_t> numResults;
+    for (unsigned batchSize: {1u, 8u}) {
+        ValidationOptions options;
+        options.useCache = false;
+        options.detector.backend = DetectorBackend::kMock;
+        options.detector.batchSize = batchSize;
+        const std::string output = dir + "batch" + std::to_string(batchSize) + ".duv.tsv";
+        files.push_back(output);
+        report.measure("macro/validate_mock/batch" + std::to_string(batchSize), kNumImages, [&] {
+            validateDataset(dir + "train.txt", "", "", "", output, options);
+        }, 1);
+        numResults.push_back(comparisonResultsFromFile(output, false).size());
+    }
+    for (const std::string& f: files)
+        remove(f.c_str());
+    rmdir(dirTemplate);
+    if (numResults.front() != numResults.back() || 0 == numResults.front()) {
+        LOG(ERROR) << "validation with mock detector saved " << numResults.front() << " and " << numResults.back()
+                   << " results";
+        return -1;
+    }
+    return 0;
+}
+
+// intersectionOverUnion of random boxes
+static int runIouBenchmark(BenchReport& report) {
+    constexpr size_t kNumPairs = 1000000;
+    std::mt19937 rng(12345);
+    std::uniform_real_distribution<double> coord(0, 0.8), size(0.01, 0.2);
+    std::vector<cv::Rect2d> boxes(kNumPairs + 1);
+    for (auto& b: boxes)
+        b = cv::Rect2d(coord(rng), coord(rng), size(rng), size(rng));
+    double sum = 0;
+    report.measure("micro/intersectionOverUnion", kNumPairs, [&] {
+        sum = 0;
+        for (size_t i = 0; i < kNumPairs; ++i)
+            sum += intersectionOverUnion(boxes[i], boxes[i + 1]);
+    });
+    LOG(INFO) << "intersectionOverUnion: mean iou " << (sum / kNumPairs);
+    return 0;
+}
+
+// single .duv rows to text and back
+static int runComparisonResultStringBenchmark(BenchReport& report) {
+    constexpr size_t kNumRows = 100000;
+    const ComparisonResults results = syntheticComparisonResults(kNumRows);
+    std::vector<std::string> lines(kNumRows);
+    report.measure("micro/ComparisonResult/toString", kNumRows, [&] {
+        for (size_t i = 0; i < kNumRows; ++i)
+            lines[i] = results[i].toString();
+    });
+    std::string buffer;
+    report.measure("micro/ComparisonResult/appendTo", kNumRows, [&] {
+        buffer.clear();
+        for (const ComparisonResult& r: results)
+            r.appendTo(buffer);
+    });
+    size_t numValid = 0;
+    report.measure("micro/ComparisonResult/fromString", kNumRows, [&] {
+        numValid = 0;
+        for (const std::string& line: lines)
+            numValid += ComparisonResult::fromString(line).isValid();
+    });
+    if (numValid != kNumRows) {
+        LOG(ERROR) << "parsed " << numValid << " of " << kNumRows << " rows";
+        return -1;
+    }
+    return 0;
+}
+
+// splitting .duv rows by tabs
+static int runSplitStringBenchmark(BenchReport& report) {
+    constexpr size_t kNumRows = 100000;
+    const ComparisonResults results = syntheticComparisonResults(kNumRows);
+    std::vector<std::string> lines;
+    for (const ComparisonResult& r: results)
+        lines.push_back(r.toString());
+    size_t numParts = 0;
+    report.measure("micro/splitString", kNumRows, [&] {
+        numParts = 0;
+        for (const std::string& line: lines)
+            numParts += splitString(line, '\t').size();
+    });
+    if (numParts != kNumRows * 9) {
+        LOG(ERROR) << "split rows into " << numParts << " parts";
+        return -1;
+    }
+    return 0;
+}
+
+// reading one small label file many times
+static int runLabelFileBenchmark(BenchReport& report) {
+    constexpr size_t kNumReads = 10000;
+    char pathTemplate[] = "/tmp/darkutils_bench_XXXXXX";
+    int fd = mkstemp(pathTemplate);
+    if (fd < 0) {
+        LOG(ERROR) << "can not create temporary label file";
+        return -1;
+    }
+    close(fd);
+    LoadedDetections dets;
+    for (int j = 0; j < 8; ++j)
+        dets.push_back(LoadedDetection{j % 3, cv::Rect2d(0.1 + j * 0.05, 0.2, 0.1, 0.15), ""});
+    saveToFile(pathTemplate, to_string(dets));
+    size_t numLoaded = 0;
+    report.measure("micro/loadedDetectionsFromFile", kNumReads, [&] {
+        numLoaded = 0;
+        for (size_t i = 0; i < kNumReads; ++i)
+            numLoaded += loadedDetectionsFromFile(pathTemplate).size();
+    });
+    remove(pathTemplate);
+    if (numLoaded != kNumReads * dets.size()) {
+        LOG(ERROR) << "loaded " << numLoaded << " marks";
+        return -1;
+    }
+    return 0;
+}
+
+// saving and loading whole .duv and .duvb files
+static int runDuvFileBenchmark(BenchReport& report) {
+    constexpr size_t kNumRows = 500000;
+    const ComparisonResults results = syntheticComparisonResults(kNumRows);
+    char dirTemplate[] = "/tmp/darkutils_bench_XXXXXX";
+    if (nullptr == mkdtemp(dirTemplate)) {
+        LOG(ERROR) << "can not create temporary folder for .duv files";
+        return -1;
+    }
+    for (const char* extension: {".duv.tsv", ".duvb"}) {
+        const std::string path = std::string(dirTemplate) + "/results" + extension;
+        const std::string name = std::string("macro/duv_io/") + (isDuvBinaryPath(path) ? "duvb" : "duv");
+        bool saved = false;
+        report.measure(name + "/save", kNumRows, [&] {saved = saveComparisonResults(path, results);});
+        size_t numLoaded = 0;
+        report.measure(name + "/load", kNumRows, [&] {numLoaded = comparisonResultsFromFile(path, false).size();});
+        remove(path.c_str());
+        if (!saved || numLoaded != kNumRows) {
+            LOG(ERROR) << "saved " << path << ": " << saved << ", loaded " << numLoaded << " of " << kNumRows << " rows";
+            rmdir(dirTemplate);
+            return -1;
+        }
+    }
+    rmdir(dirTemplate);
+    return 0;
+}
+
+int runAllBenchmarks(const std::string& jsonPath, const std::string& filter) {
+    static const std::vector<std::pair<std::string, std::function<int(BenchReport&)>>> benchmarks = {
+          {"micro/intersectionOverUnion", &runIouBenchmark}
+        , {"micro/ComparisonResult", &runComparisonResultStringBenchmark}
+        , {"micro/splitString", &runSplitStringBenchmark}
+        , {"micro/loadedDetectionsFromFile", &runLabelFileBenchmark}
+        , {"micro/img_diff", &runImgDiffBenchmark}
+        , {"macro/duv_parse", &runDuvParsingBenchmark}
+        , {"macro/duv_io", &runDuvFileBenchmark}
+        , {"macro/label_loading", &runLabelLoadingBenchmark}
+        , {"macro/compare_predictions/20x400", [](BenchReport& r) {return runComparePredictionsBenchmark(r, 20, 400);}}
+        , {"macro/compare_predictions/2x4000", [](BenchReport& r) {return runComparePredictionsBenchmark(r, 2, 4000);}}
+        , {"macro/dedup", &runDedupBenchmark}
+        , {"macro/dataset_listing", &runDatasetEnumBenchmark}
+        , {"macro/validate_mock", &runMockValidationBenchmark}
+    };
+    BenchReport report;
+    for (const auto& b: benchmarks) {
+        if (b.first.find(filter) == std::string::npos)
+            continue;
+        if (b.second(report) != 0) {
+            LOG(ERROR) << "benchmark " << b.first << " failed";
+            return -1;
+        }
+    }
+    const std::string json = report.toJson();
+    if (!saveToFile(jsonPath, json)) {
+        LOG(ERROR) << "failed to save benchmark results to " << jsonPath;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,12 @@
+#ifndef DU_BENCH_H
+#define DU_BENCH_H
+
+#include <string>
+
+// runs performance benchmarks on synthetic data and logs timings; no network weights are needed.
+// Timings are saved as JSON to jsonPath (a file, because stdout is taken by the logs).
+// Only benchmarks whose name (e.g. "micro/splitString", "macro/duv_io") contains filter are run.
+// Returns 0 if all benchmarks succeeded
+int runAllBenchmarks(const std::string& jsonPath, const std::string& filter = "");
+
+#endif // DU_BENCH_H
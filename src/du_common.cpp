@@ -1,28 +1,58 @@
 #include "du_common.h"
 #include "helpers.h"
+#include "duv_io.h"
+#include "parallel.h"
+#include "dataset_enum.h"
 #include <algorithm>
+#include <charconv>
 #include <string>
 #include <vector>
 #include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
 
 using namespace std;
 
 static const std::string kDotJpg{".jpg"};
 
-std::string ComparisonResult::toString() const {
+// append number to string, formatted as by ostream with default precision
+template<class T>
+static void appendNumber(std::string& out, T value) {
+    char buf[32];
+    std::to_chars_result res;
+    if constexpr (std::is_integral<T>::value)
+        res = std::to_chars(buf, buf + sizeof(buf), value);
+    else
+        res = std::to_chars(buf, buf + sizeof(buf), value, std::chars_format::general, 6);
+    out.append(buf, res.ptr);
+}
+
+void ComparisonResult::appendTo(std::string& out) const {
     double x = bbox.x + bbox.width / 2;
     double y = bbox.y + bbox.height / 2;
-    char treatedChar = treated ? 't' : 'f';
-    ostringstream ss;
-    ss << filename << '\t' << classId << '\t' << x << '\t' << y << '\t' << bbox.width
-           << '\t' << bbox.height << '\t' << prob << '\t' << iou << '\t' << treatedChar;
-    return ss.str();
+    out += filename;
+    out += '\t';
+    appendNumber(out, classId);
+    for (double v: {x, y, bbox.width, bbox.height, double(prob), double(iou)}) {
+        out += '\t';
+        appendNumber(out, v);
+    }
+    out += '\t';
+    out += treated ? 't' : 'f';
+}
+
+std::string ComparisonResult::toString() const {
+    std::string s;
+    appendTo(s);
+    return s;
 }
 
 std::string to_string(const ComparisonResults& results) {
     std::string s;
-    for (const auto& r: results)
-        s += r.toString() + "\n";
+    for (const auto& r: results) {
+        r.appendTo(s);
+        s += '\n';
+    }
     return s;
 }
 
@@ -82,62 +112,120 @@ float intersectionOverUnion(const cv::Rect2d& r1, const cv::Rect2d& r2) {
 }
 
 std::vector<std::string> loadTrainImageFilenames(const std::string& path, bool labeledFiles) {
-    std::vector<std::string> filesList = listFilesInDir(path);
-    std::vector<std::string> result;
-    result.reserve(filesList.size()/2);
-    std::sort(filesList.begin(), filesList.end());
-
-    // add file to 'result' if two consecutive files have same basenames and end with ".jpg" and ".txt" accordingly
-    for (size_t i = 0; i < filesList.size() - 1; ++i) {
-        std::string& curr = filesList[i];
-        if (std::string::npos == curr.rfind(kDotJpg))
-            continue;
-        // find basename.txt file follows after
-        std::string baseFileName = getBaseFileName(curr);
-        int txtFileIndex = i;
-        bool txtFileExists = false;
-        while (!txtFileExists
-                && txtFileIndex < filesList.size()
-                && baseFileName == getBaseFileName(filesList[txtFileIndex])) {
-            txtFileExists |= (baseFileName + ".txt" == filesList[txtFileIndex]);
-            ++txtFileIndex;
-        }
-        if ((labeledFiles && txtFileExists) || (!labeledFiles && !txtFileExists))
-            result.push_back(baseFileName);
-    }
-    return result;
+    const DatasetDirListing listing = listDatasetDir(path);
+    const std::vector<std::string_view>& names = labeledFiles ? listing.labeled : listing.unlabeled;
+    return std::vector<std::string>(names.begin(), names.end());
 }
 
 LoadedDetections loadedDetectionsFromFile(const std::string& path) {
     vector<LoadedDetection> result;
-    auto content = getFileContents(path);
-    auto l = splitString(content, '\n');
-    for (const std::string& s: l) {
-        auto parts = splitString(s, ' ');
-        if (parts.size() != 5) {
-            LOG(ERROR) << "loadedDetectionsFromFile: bad line \"" << s << "\"";
-            continue;
-        }
+    std::vector<LabelBox> boxes;
+    parseDarknetLabels(getFileContents(path), boxes, path);
+    const std::string filename = extractFilenameFromFullPath(path);
+    result.reserve(boxes.size());
+    for (const auto& b: boxes)
+        result.push_back(LoadedDetection{b.classId, b.bbox, filename});
+    return result;
+}
 
-        int classId;
-        double midX, midY, relW, relH;
-        try {
-            classId = stoi(parts[0].c_str());
-            midX = stof(parts[1].c_str());
-            midY = stof(parts[2].c_str());
-            relW = stof(parts[3].c_str());
-            relH = stof(parts[4].c_str());
-        } catch (const std::exception& ex) {
-            LOG(ERROR) << "loadedDetectionsFromFile: failed to parse line in " << path << ". Line:\n" << s;
+// true for characters separating numbers in label files
+static inline bool isLabelSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+size_t parseDarknetLabels(std::string_view content, std::vector<LabelBox>& boxes, const std::string& sourceName) {
+    size_t numBadLines = 0;
+    while (!content.empty()) {
+        size_t eol = content.find('\n');
+        std::string_view line = content.substr(0, eol);
+        content.remove_prefix(std::string_view::npos == eol ? content.size() : eol + 1);
+
+        // "class x y w h", where x,y is midpoint
+        int classId = -1;
+        float values[4];
+        int numFields = 0;
+        bool ok = true;
+        const char* p = line.data();
+        const char* lineEnd = line.data() + line.size();
+        while (ok) {
+            while (p < lineEnd && isLabelSpace(*p))
+                ++p;
+            if (p == lineEnd)
+                break;
+            std::from_chars_result res = (numFields == 0) ? std::from_chars(p, lineEnd, classId)
+                                       : (numFields < 5)  ? std::from_chars(p, lineEnd, values[numFields-1])
+                                                          : std::from_chars_result{p, std::errc::invalid_argument};
+            ok = (res.ec == std::errc() && (res.ptr == lineEnd || isLabelSpace(*res.ptr)));
+            p = res.ptr;
+            ++numFields;
+        }
+        if (numFields == 0)
+            continue; // empty line
+        if (!ok || numFields != 5) {
+            LOG(ERROR) << "parseDarknetLabels: bad line in " << sourceName << ": \"" << line << "\"";
+            ++numBadLines;
             continue;
         }
-
-        cv::Rect2d bbox(midX - relW/2, midY - relH/2, relW, relH);
-        LoadedDetection d{classId, bbox, extractFilenameFromFullPath(path)};
-        result.push_back(d);
+        const float midX = values[0], midY = values[1], relW = values[2], relH = values[3];
+        boxes.push_back(LabelBox{classId, cv::Rect2d(midX - relW/2, midY - relH/2, relW, relH)});
     }
+    return numBadLines;
+}
 
-    return result;
+// read whole file into buffer, reusing its memory. Returns false if file can't be read
+static bool readWholeFile(const std::string& path, std::string& buffer) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    buffer.clear();
+    char chunk[16 << 10];
+    ssize_t n;
+    while ((n = read(fd, chunk, sizeof(chunk))) > 0)
+        buffer.append(chunk, n);
+    close(fd);
+    return n == 0;
+}
+
+DatasetLabels loadDatasetLabels(const std::vector<std::string>& pathsToImages, unsigned numThreads) {
+    // every chunk of images is parsed into its own array, then the arrays are joined in order
+    constexpr size_t kChunkSize = 512;
+    const size_t numImages = pathsToImages.size();
+    const size_t numChunks = (numImages + kChunkSize - 1) / kChunkSize;
+    std::vector<std::vector<LabelBox>> chunkBoxes(numChunks);
+    std::vector<size_t> counts(numImages, 0);
+    std::vector<size_t> chunkBadLines(numChunks, 0);
+    DatasetLabels labels;
+    labels.found.assign(numImages, 0);
+
+    parallelFor(numImages, numThreads, kChunkSize, [&](size_t begin, size_t end) {
+        const size_t chunk = begin / kChunkSize;
+        std::string buffer, path;
+        for (size_t i = begin; i < end; ++i) {
+            path = pathsToImages[i] + ".txt";
+            if (!readWholeFile(path, buffer)) {
+                LOG(ERROR) << "loadDatasetLabels: can\'t read " << path;
+                continue;
+            }
+            labels.found[i] = 1;
+            const size_t before = chunkBoxes[chunk].size();
+            chunkBadLines[chunk] += parseDarknetLabels(buffer, chunkBoxes[chunk], path);
+            counts[i] = chunkBoxes[chunk].size() - before;
+        }
+    });
+
+    size_t totalBoxes = 0;
+    for (const auto& b: chunkBoxes)
+        totalBoxes += b.size();
+    labels.boxes.reserve(totalBoxes);
+    for (size_t c = 0; c < numChunks; ++c) {
+        labels.boxes.insert(labels.boxes.end(), chunkBoxes[c].begin(), chunkBoxes[c].end());
+        labels.numBadLines += chunkBadLines[c];
+    }
+    labels.offsets.resize(numImages + 1);
+    labels.offsets[0] = 0;
+    for (size_t i = 0; i < numImages; ++i)
+        labels.offsets[i+1] = labels.offsets[i] + counts[i];
+    return labels;
 }
 
 ComparisonResult ComparisonResult::fromString(const std::string& str) {
@@ -183,15 +271,15 @@ ComparisonResult ComparisonResult::generateInvalid() {
     return ComparisonResult{-1, cv::Rect2d(-1,-1,-1,-1), -1, -1, "", false};
 }
 
-bool ComparisonResult::isToAdd() const {
+bool ComparisonResult::isToAdd(const ValidationThresholds& thresholds) const {
     return !treated
-            && prob >= kValidationProbThresh
-            && iou < kStrongIntersectionThresh;
+            && prob >= thresholds.prob
+            && iou < thresholds.iou;
 }
-bool ComparisonResult::isToRemove() const {
+bool ComparisonResult::isToRemove(const ValidationThresholds& thresholds) const {
     return !treated
-            && prob < kValidationProbThresh
-            && iou < kStrongIntersectionThresh;
+            && prob < thresholds.prob
+            && iou < thresholds.iou;
 }
 
 LoadedDetection ComparisonResult::toLoadedDet() const {
@@ -199,17 +287,20 @@ LoadedDetection ComparisonResult::toLoadedDet() const {
 }
 
 ComparisonResults comparisonResultsFromFile(const std::string& filename, bool ignoreTreatedDets) {
+    if (isDuvBinaryFile(filename)) {
+        DuvBinaryView view(filename);
+        return view.isValid() ? view.toComparisonResults(ignoreTreatedDets) : ComparisonResults();
+    }
     ComparisonResults rs;
-    auto lines = getFileContentsAsStringVector(filename);
-    for (const auto& l: lines) {
-        ComparisonResult r = ComparisonResult::fromString(l);
-        if (!r.isValid()) {
-            LOG(ERROR) << "Can not parse line to ComparisonResults: " << l;
-        } else if (!ignoreTreatedDets || !r.treated) {
-            rs.push_back(r);
-        }
+    MappedFile file(filename);
+    if (!file.isOpen()) {
+        LOG_IF(!ifFileExists(filename), ERROR) << "comparisonResultsFromFile: can\'t open file " << filename;
+        return rs;
     }
-
+    std::string_view content(file.data(), file.size());
+    // rough estimate of number of rows to avoid reallocations
+    rs.reserve(file.size() / 48);
+    parseDuvBuffer(content, rs, ignoreTreatedDets, filename);
     return rs;
 }
 
@@ -225,30 +316,91 @@ int findDetection(const LoadedDetections& dets, const LoadedDetection& needle) {
     return -1;
 }
 
-std::vector<string> loadPathsToImages(const string &pathToTrainTxt) {
-    std::vector<std::string> result;
+int countDetections(const LoadedDetections& dets, const LoadedDetection& needle) {
+    const string needleFilename = extractFilenameFromFullPath(needle.filename);
+    constexpr float kIouThresh = 0.99;
+    int count = 0;
+    for (const auto& d: dets) {
+        if (d.classId == needle.classId && extractFilenameFromFullPath(d.filename) == needleFilename
+                && intersectionOverUnion(d.bbox, needle.bbox) > kIouThresh)
+            ++count;
+    }
+    return count;
+}
+
+BoxesSoA boxesOf(const LoadedDetections& dets) {
+    BoxesSoA boxes;
+    boxes.reserve(dets.size());
+    for (const auto& d: dets)
+        boxes.push_back(d.bbox);
+    return boxes;
+}
+
+int findDetection(const LoadedDetections& dets, const BoxGrid& detsGrid, const LoadedDetection& needle) {
+    const string needleFilename = extractFilenameFromFullPath(needle.filename);
+    constexpr float kIouThresh = 0.99;
+    std::vector<int> candidates;
+    detsGrid.intersecting(needle.bbox.x, needle.bbox.y, needle.bbox.x + needle.bbox.width,
+                          needle.bbox.y + needle.bbox.height, candidates);
+    for (int i: candidates) {
+        if (dets[i].classId == needle.classId
+                && extractFilenameFromFullPath(dets[i].filename) == needleFilename
+                && intersectionOverUnion(dets[i].bbox, needle.bbox) > kIouThresh)
+            return i;
+    }
+    return -1;
+}
+
+std::vector<std::pair<int, int>> findOverlappingPairs(const LoadedDetections& dets, float iouThresh) {
+    std::vector<std::pair<int, int>> result;
+    const BoxesSoA boxes = boxesOf(dets);
+    for (const BoxMatch& pair: overlappingPairs(boxes, boxes)) {
+        if (pair.pred < pair.gt && dets[pair.pred].classId == dets[pair.gt].classId
+                && intersectionOverUnion(dets[pair.pred].bbox, dets[pair.gt].bbox) > iouThresh)
+            result.emplace_back(pair.pred, pair.gt);
+    }
+    return result;
+}
+
+std::vector<std::string_view> loadPathsToImages(const std::string& pathToTrainTxt, PathArena& arena) {
+    std::vector<std::string_view> result;
 
     // retreive the location of train.txt file
-    std::string listPath;
+    std::string_view listPath;
     auto ios = pathToTrainTxt.find_last_of('/');
     if (std::string::npos != ios)
-        listPath = pathToTrainTxt.substr(0, ios + 1);
-
-    // load list of image paths from train.txt
-    auto list = getFileContentsAsStringVector(pathToTrainTxt, false);
+        listPath = std::string_view(pathToTrainTxt).substr(0, ios + 1);
+
+    // lines are looked at in place, only the resulting paths are copied
+    std::string_view content;
+    MappedFile mapped(pathToTrainTxt);
+    if (mapped.isOpen()) {
+        content = std::string_view(mapped.data(), mapped.size());
+    } else if (!ifFileExists(pathToTrainTxt)) {
+        LOG(ERROR) << "getFileContents: can\'t open file " << pathToTrainTxt;
+        return result;
+    } // else the file is empty
+    result.reserve(std::count(content.begin(), content.end(), '\n') + 1);
     int lineNumber{-1};
-    for (std::string s: list) {
+    while (!content.empty()) {
+        const size_t eol = content.find('\n');
+        std::string_view s = content.substr(0, eol);
+        content.remove_prefix(std::string_view::npos == eol ? content.size() : eol + 1);
         ++lineNumber;
-        if (!strEndsWith(s, kDotJpg)) {
-            LOG_N_TIMES(1, ERROR) << "Bad image path. Line#" << lineNumber << " in " << pathToTrainTxt << ": " << s
-                                     << ". Other errors truncated";
+        if (s.size() <= kDotJpg.size() || s.substr(s.size() - kDotJpg.size()) != kDotJpg) {
+            LOG_N_TIMES(1, ERROR) << "Bad image path. Line#" << lineNumber << " in " << pathToTrainTxt << ": "
+                                  << std::string(s) << ". Other errors truncated";
             continue;
         }
-        s = s.substr(0, s.size() - kDotJpg.size());
-        if ('/' == s.front())
-            result.push_back(s); // absolute image path
-        else
-            result.push_back(listPath + s); // image path relative to train.txt
+        s.remove_suffix(kDotJpg.size());
+        // image path relative to train.txt, or absolute
+        result.push_back(arena.add('/' != s.front() ? listPath : std::string_view(), s));
     }
     return result;
 }
+
+std::vector<string> loadPathsToImages(const string &pathToTrainTxt) {
+    PathArena arena;
+    const std::vector<std::string_view> paths = loadPathsToImages(pathToTrainTxt, arena);
+    return std::vector<std::string>(paths.begin(), paths.end());
+}
@@ -3,8 +3,11 @@
 
 #include <vector>
 #include <string>
+#include <string_view>
+#include <cstdint>
 #include <opencv2/opencv.hpp>
 #include <DarkHelp.hpp>
+#include "box_matching.h"
 
 using std::to_string;
 
@@ -13,6 +16,12 @@ constexpr float kStrongIntersectionThresh = 0.45;
 // minimum detection probability
 constexpr float kValidationProbThresh = 0.15;
 
+// thresholds to compare predictions with ground truth; .duv made by validate uses the defaults
+struct ValidationThresholds {
+    float prob = kValidationProbThresh;
+    float iou = kStrongIntersectionThresh;
+};
+
 // returns relaive bbox of prediction result. Note that x,y are still the coordinates of top-left corner, just in [0,1] interval.
 inline cv::Rect2d relativeBbox(const DarkHelp::PredictionResult& r) {
     return cv::Rect2d(
@@ -46,6 +55,45 @@ LoadedDetections loadedDetectionsFromFile(const std::string& filename);
 // Convert LoadedDetections to newline-seaprated string, compatible with darknet/yolomark format
 std::string to_string(const LoadedDetections& dets);
 int findDetection(const LoadedDetections& dets, const LoadedDetection& needle);
+// number of marks in dets that findDetection would consider equal to needle, > 1 if it's marked several times
+int countDetections(const LoadedDetections& dets, const LoadedDetection& needle);
+// bboxes of dets, e.g. to build BoxGrid
+BoxesSoA boxesOf(const LoadedDetections& dets);
+// same as findDetection above, for many lookups in large dets. detsGrid must be built from boxesOf(dets)
+int findDetection(const LoadedDetections& dets, const BoxGrid& detsGrid, const LoadedDetection& needle);
+// pairs of marks {i, j}, i < j, of the same class with iou > iouThresh: probably one object marked twice
+std::vector<std::pair<int, int>> findOverlappingPairs(const LoadedDetections& dets,
+                                                      float iouThresh = kStrongIntersectionThresh);
+
+// ground truth mark without filename, as stored by loadDatasetLabels
+struct LabelBox {
+    int classId;
+    cv::Rect2d bbox; // relative, x,y is top-left corner
+};
+
+// Parse darknet label file contents ("class x y w h" lines, x,y is midpoint) in place, appending boxes.
+// Bad lines are logged with sourceName and skipped. Returns number of bad lines
+size_t parseDarknetLabels(std::string_view content, std::vector<LabelBox>& boxes, const std::string& sourceName);
+
+// ground truth marks of the whole dataset in one contiguous array
+struct DatasetLabels {
+    // marks of image i are boxes[offsets[i]] ... boxes[offsets[i+1] - 1]
+    std::vector<LabelBox> boxes;
+    std::vector<size_t> offsets;
+    // 1 if label file of image i was read, 0 if it's missing or unreadable
+    std::vector<uint8_t> found;
+    // number of lines that couldn't be parsed, in all files
+    size_t numBadLines = 0;
+
+    size_t numImages() const {return found.size();}
+    size_t numBoxes(size_t image) const {return offsets[image+1] - offsets[image];}
+    const LabelBox* begin(size_t image) const {return boxes.data() + offsets[image];}
+    const LabelBox* end(size_t image) const {return boxes.data() + offsets[image+1];}
+};
+
+// read .txt labels of all images in parallel (numThreads = 0 uses all cores).
+// pathsToImages are paths without extension, as returned by loadPathsToImages
+DatasetLabels loadDatasetLabels(const std::vector<std::string>& pathsToImages, unsigned numThreads = 0);
 
 struct ComparisonResult {
     int classId = -1; // as predicted by darknet
@@ -57,6 +105,8 @@ struct ComparisonResult {
 
     // outputs detection as "filename c x y w h % iou treated", where (x,y) is relative mid-point, (w,h) is relative size
     std::string toString() const;
+    // append toString() result to \param out without temporary strings
+    void appendTo(std::string& out) const;
     // read from string in .duv format
     static ComparisonResult fromString(const std::string& str);
     // returns false if classId < 0, prop<0, iou < 0 or filename is empty or slashy
@@ -64,9 +114,9 @@ struct ComparisonResult {
     // returns ComparisonResult object in obviously invalid state
     static ComparisonResult generateInvalid();
     // returns true if it's likely to be unmarked positive which needs to be added to .txt
-    bool isToAdd() const;
+    bool isToAdd(const ValidationThresholds& thresholds = ValidationThresholds()) const;
     // returns true if it's likely to be marked false negative which needs to be removed from the .txt
-    bool isToRemove() const;
+    bool isToRemove(const ValidationThresholds& thresholds = ValidationThresholds()) const;
     // convert to "loaded detection"
     LoadedDetection toLoadedDet() const;
 };
@@ -76,6 +126,7 @@ inline bool ProbIsBigger(const ComparisonResult& lhs, const ComparisonResult& rh
 inline bool AreaIsBigger(const ComparisonResult& lhs, const ComparisonResult& rhs) {return lhs.bbox.area() > rhs.bbox.area();}
 // newline-separated results, with "\n" at the end as well
 std::string to_string(const ComparisonResults& results);
+// load results from .duv, either tab-separated or binary (.duvb)
 ComparisonResults comparisonResultsFromFile(const std::string& filename, bool ignoreTreatedDets);
 
 // rect to human-readable string (not compatible with darknet mark .txt files!)
@@ -94,5 +145,8 @@ std::vector<std::string> loadTrainImageFilenames(const std::string& path, bool l
 
 // returns paths to images written in train.txt relative to application (or absolute paths) without .jpg extention
 std::vector<std::string> loadPathsToImages(const std::string& pathToTrainTxt);
+class PathArena;
+// same, paths are stored in arena (no allocation per path)
+std::vector<std::string_view> loadPathsToImages(const std::string& pathToTrainTxt, PathArena& arena);
 
 #endif // DU_COMMON_H
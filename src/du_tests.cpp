@@ -1,10 +1,35 @@
 #include <du_tests.h>
 #include "du_common.h"
 #include "helpers.h"
+#include "prediction_store.h"
+#include "duv_io.h"
+#include "cure_index.h"
+#include "cure_journal.h"
+#include "label_cache.h"
+#include "box_matching.h"
+#include "validation.h"
+#include "evaluation.h"
+#include "rethreshold.h"
+#include "tracker.h"
+#include "cv_funcs.h"
+#include "dedup.h"
+#include "sanity_check.h"
+#include "dataset_enum.h"
+#include "detector.h"
 #include "easylogging++.h"
 #include <opencv2/opencv.hpp>
 #include <string>
 #include <vector>
+#include <random>
+#include <map>
+#include <numeric>
+#include <functional>
+#include <memory>
+#include <algorithm>
+#include <limits>
+#include <cstddef>
+#include <cstring>
+#include <unistd.h>
 
 struct IouTest {
     cv::Rect2f r1;
@@ -70,6 +95,10 @@ int runCmpResultsFromStringTests(const std::string&) {
         LOG(ERROR) << "runCmpResultsFromStringTests: parsed wrong: is " << r.toString() << "\n but shold be this:\n" << str;
         return -1;
     }
+    if (r.toString() != str) {
+        LOG(ERROR) << "runCmpResultsFromStringTests: toString() gives " << r.toString() << " instead of " << str;
+        return -1;
+    }
     return 0;
 }
 
@@ -149,6 +178,793 @@ int runTxtLoadingTest(const std::string& testsDir) {
     return 0;
 }
 
+int runPredictionStoreTest(const std::string& testsDir) {
+    const std::string storePath = testsDir + "/prediction_store_test.tmp";
+    DarkHelp::PredictionResult p;
+    p.original_point = cv::Point2f(0.5, 0.25);
+    p.original_size = cv::Size2f(0.1, 0.2);
+    p.best_class = 1;
+    p.best_probability = 0.75;
+    p.all_probabilities = {{0, 0.3}, {1, 0.75}};
+
+    PredictionStore store(42, kValidationProbThresh);
+    store.put("path/to/img", StoredPredictions{100, 12345, {p, p}});
+    if (!store.save(storePath)) {
+        LOG(ERROR) << "runPredictionStoreTest: failed to save " << storePath;
+        return -1;
+    }
+    PredictionStore otherModel(43, kValidationProbThresh);
+    PredictionStore loaded(42, kValidationProbThresh);
+    bool otherModelLoaded = otherModel.load(storePath);
+    bool sameModelLoaded = loaded.load(storePath);
+    remove(storePath.c_str());
+    if (otherModelLoaded || !sameModelLoaded) {
+        LOG(ERROR) << "runPredictionStoreTest: store must only be loaded for the same model";
+        return -1;
+    }
+    if (nullptr != loaded.find("path/to/img", 100, 12346)) {
+        LOG(ERROR) << "runPredictionStoreTest: found predictions for modified image";
+        return -1;
+    }
+    const StoredPredictions* entry = loaded.find("path/to/img", 100, 12345);
+    if (nullptr == entry || entry->predictions.size() != 2
+            || !almostEqual(entry->predictions[1].original_point.y, 0.25)
+            || !almostEqual(getProb(entry->predictions[1], 0), 0.3)
+            || entry->predictions[1].best_class != 1) {
+        LOG(ERROR) << "runPredictionStoreTest: predictions loaded wrong";
+        return -1;
+    }
+    return 0;
+}
+
+int runDuvBinaryTest(const std::string& pathToTestFolder) {
+    const std::string pathToDuv = pathToTestFolder + pathToTestDuv;
+    const std::string pathToDuvb = pathToTestFolder + "/duv_binary_test.tmp.duvb";
+    auto results = comparisonResultsFromFile(pathToDuv, false);
+    DuvBinaryInfo info;
+    info.modelFingerprint = 42;
+    if (!saveDuvBinary(pathToDuvb, results, info)) {
+        LOG(ERROR) << "runDuvBinaryTest: failed to save " << pathToDuvb;
+        return -1;
+    }
+    auto loaded = comparisonResultsFromFile(pathToDuvb, false);
+    DuvBinaryView view(pathToDuvb);
+    const bool infoKept = view.isValid() && view.info().modelFingerprint == 42;
+    if (!infoKept || loaded.size() != results.size()) {
+        remove(pathToDuvb.c_str());
+        LOG(ERROR) << "runDuvBinaryTest: loaded " << loaded.size() << " results instead of " << results.size();
+        return -1;
+    }
+    // damaged counts and offsets must be rejected, not read out of the mapping
+    const std::string bytes = [&pathToDuvb]() {
+        MappedFile file(pathToDuvb);
+        return std::string(file.data(), file.size());
+    }();
+    remove(pathToDuvb.c_str());
+    const DuvBinaryHeader header = *reinterpret_cast<const DuvBinaryHeader*>(bytes.data());
+    const std::vector<std::pair<size_t, uint64_t>> damages = {
+        {offsetof(DuvBinaryHeader, numRows), uint64_t(1) << 62},
+        {offsetof(DuvBinaryHeader, numFilenames), std::numeric_limits<uint64_t>::max()},
+        {offsetof(DuvBinaryHeader, filenameCharsOffset), header.fileSize + 8},
+        {header.filenameOffsetsOffset + header.numFilenames * sizeof(uint64_t), header.fileSize}};
+    for (const auto& damage: damages) {
+        std::string damaged = bytes;
+        memcpy(&damaged[damage.first], &damage.second, sizeof(uint64_t));
+        saveToFile(pathToDuvb, damaged);
+        const bool rejected = !DuvBinaryView(pathToDuvb).isValid();
+        remove(pathToDuvb.c_str());
+        if (!rejected) {
+            LOG(ERROR) << "runDuvBinaryTest: .duvb with damaged value at byte " << damage.first << " was accepted";
+            return -1;
+        }
+    }
+    for (size_t i = 0; i < results.size(); ++i) {
+        const auto& a = results[i];
+        const auto& b = loaded[i];
+        constexpr float delta = 1e-6;
+        if (a.filename != b.filename || a.classId != b.classId || a.treated != b.treated
+                || fabs(a.bbox.x - b.bbox.x) > delta || fabs(a.bbox.y - b.bbox.y) > delta
+                || fabs(a.bbox.width - b.bbox.width) > delta || fabs(a.bbox.height - b.bbox.height) > delta
+                || fabsf(a.prob - b.prob) > delta || fabsf(a.iou - b.iou) > delta) {
+            LOG(ERROR) << "runDuvBinaryTest: " << b.toString() << " loaded from .duvb instead of " << a.toString();
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int runDuvParserTest(const std::string&) {
+    const std::string duv = "img 1\t2\t0.5\t0.5\t0.5\t0.5\t0.5\t0.5\tf\n"
+                            "bad line\n"
+                            "img 2\t1\t0.5\t0.5\t0.2\t0.2\t-1\t0.5\tf\n" // invalid prob
+                            "img 2\t1\t0.5\t0.5\t0.2\t0.2\t0.9\t0.1\tt\n"
+                            "img 3\t0\t0.5\t0.5\t0.2\t0.2\t0.9\t0.1\tf";
+    ComparisonResults results;
+    size_t numMalformed = parseDuvBuffer(duv, results, true, "test buffer");
+    if (numMalformed != 2 || results.size() != 2) {
+        LOG(ERROR) << "runDuvParserTest: expected 2 malformed and 2 parsed rows, got " << numMalformed
+                   << " and " << results.size();
+        return -1;
+    }
+    const std::string firstLine = duv.substr(0, duv.find('\n'));
+    if (results[0].toString() != ComparisonResult::fromString(firstLine).toString() || results[1].filename != "img 3") {
+        LOG(ERROR) << "runDuvParserTest: parsed wrong: " << results[0].toString() << ", " << results[1].toString();
+        return -1;
+    }
+    return 0;
+}
+
+int runDatasetLabelsTest(const std::string& testsDir) {
+    auto imgsPaths = loadPathsToImages(testsDir + "masks_train.txt");
+    imgsPaths.push_back(testsDir + "masks_files/no_such_image");
+    DatasetLabels labels = loadDatasetLabels(imgsPaths, 2);
+    const std::vector<size_t> expectedNumBoxes = {0, 1, 4, 1, 0};
+    if (labels.numImages() != expectedNumBoxes.size() || labels.boxes.size() != 6 || labels.found.back() != 0) {
+        LOG(ERROR) << "runDatasetLabelsTest: loaded " << labels.boxes.size() << " boxes of " << labels.numImages() << " images";
+        return -1;
+    }
+    for (size_t i = 0; i + 1 < imgsPaths.size(); ++i) {
+        auto dets = loadedDetectionsFromFile(imgsPaths[i] + ".txt");
+        if (labels.numBoxes(i) != expectedNumBoxes[i] || dets.size() != expectedNumBoxes[i]) {
+            LOG(ERROR) << "runDatasetLabelsTest: " << labels.numBoxes(i) << " boxes loaded for " << imgsPaths[i];
+            return -1;
+        }
+        for (size_t j = 0; j < dets.size(); ++j) {
+            const LabelBox& b = labels.begin(i)[j];
+            if (b.classId != dets[j].classId || intersectionOverUnion(b.bbox, dets[j].bbox) < 0.999) {
+                LOG(ERROR) << "runDatasetLabelsTest: box #" << j << " of " << imgsPaths[i] << " differs";
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// returns index of the best row to review, by scanning all rows
+static int bestCmpToShowByScan(const ComparisonResults& rs, const CureIndex& index, bool toAdd, int classId) {
+    int best = -1;
+    for (int i = 0; i < int(rs.size()); ++i) {
+        if (index.isErased(i) || (toAdd ? !rs[i].isToAdd() : !rs[i].isToRemove()) || (classId >= 0 && rs[i].classId != classId))
+            continue;
+        double key = toAdd ? rs[i].prob : rs[i].bbox.area();
+        double bestKey = (best < 0) ? 0 : (toAdd ? rs[best].prob : rs[best].bbox.area());
+        if (best < 0 || key > bestKey)
+            best = i;
+    }
+    return best;
+}
+
+int runCureIndexTest(const std::string&) {
+    std::mt19937 rng(7);
+    ComparisonResults rs;
+    for (int i = 0; i < 500; ++i) {
+        float prob = (rng() % 3 == 0) ? 0 : (rng() % 100) / 100.;
+        float side = (rng() % 20 + 1) / 40.;
+        rs.push_back(ComparisonResult{int(rng() % 3), cv::Rect2d(0.1, 0.1, side, side), prob, 0.f, "img", false});
+    }
+    CureIndex index(rs);
+    for (int step = 0; step < 400; ++step) {
+        const bool toAdd = (step % 2 == 0);
+        const int classId = (step % 3 == 0) ? -1 : int(rng() % 3);
+        int expected = bestCmpToShowByScan(rs, index, toAdd, classId);
+        int got = index.next(toAdd, std::make_pair(classId >= 0, classId));
+        std::vector<int> upcoming = index.peek(toAdd, std::make_pair(classId >= 0, classId), 3);
+        if ((got < 0) != upcoming.empty() || (got >= 0 && upcoming.front() != got)) {
+            LOG(ERROR) << "runCureIndexTest: peek() doesn't start with next() on step " << step;
+            return -1;
+        }
+        if (expected != got) {
+            LOG(ERROR) << "runCureIndexTest: next() returned " << got << " instead of " << expected << " on step " << step;
+            return -1;
+        }
+        if (got >= 0 && rng() % 4 == 0)
+            index.markErased(got);
+        else if (got >= 0)
+            rs[got].treated = true;
+    }
+    // a .duv made with IoU threshold 0.3: prediction matched to a mark with iou 0.35 is not "to add"
+    const ComparisonResults matched = {ComparisonResult{0, cv::Rect2d(0.1, 0.1, 0.2, 0.2), 0.9, 0.35, "img", false}};
+    ValidationThresholds lowIou;
+    lowIou.iou = 0.3;
+    CureIndex defaultIndex(matched), lowIouIndex(matched, lowIou);
+    const auto anyClass = std::make_pair(false, 0);
+    if (defaultIndex.next(true, anyClass) != 0 || lowIouIndex.next(true, anyClass) != -1
+            || lowIouIndex.next(false, anyClass) != -1) {
+        LOG(ERROR) << "runCureIndexTest: thresholds of .duv are not respected";
+        return -1;
+    }
+    return 0;
+}
+
+int runCureJournalTest(const std::string& testsDir) {
+    const std::string pathToDuv = testsDir + "/cure_journal_test.tmp.duv.tsv";
+    ComparisonResults original = comparisonResultsFromFile(testsDir + pathToTestDuv, false);
+    saveToFile(pathToDuv, to_string(original));
+    {
+        CureJournal journal(pathToDuv);
+        std::vector<int> erased;
+        ComparisonResults rs = original;
+        journal.replay(rs, erased);
+        journal.record(CureJournal::kAccepted, 3);
+        journal.record(CureJournal::kErased, 0);
+        journal.record(CureJournal::kTreated, 5);
+    }
+    CureJournal journal(pathToDuv);
+    std::vector<int> erased;
+    ComparisonResults rs = comparisonResultsFromFile(pathToDuv, false);
+    size_t numReplayed = journal.replay(rs, erased);
+    bool replayedOk = (numReplayed == 3 && erased == std::vector<int>{0} && rs[3].treated && almostEqual(rs[3].iou, 1)
+                       && rs[5].treated && !rs[4].treated);
+    rs.erase(rs.begin());
+    bool compacted = journal.compact(rs);
+    ComparisonResults reloaded = comparisonResultsFromFile(pathToDuv, false);
+    bool journalRemoved = !ifFileExists(pathToDuv + ".journal");
+    remove(pathToDuv.c_str());
+    if (!replayedOk || !compacted || !journalRemoved || reloaded.size() != original.size() - 1 || !reloaded[2].treated) {
+        LOG(ERROR) << "runCureJournalTest: decisions were not replayed or compacted correctly";
+        return -1;
+    }
+    return 0;
+}
+
+// cure crashed after journaling decisions but before LabelCache wrote the .txt: next session applies them again
+int runCureJournalReapplyTest(const std::string& testsDir) {
+    const std::string dir = testsDir + "cure_reapply_test.tmp/";
+    createFolderIfDoesntExist(dir);
+    const std::string pathToDuv = dir + "results.duv.tsv", pathToTxt = dir + "img.txt";
+    const std::string pathToDupTxt = dir + "dup.txt";
+    const std::string originalLabels = "0 0.5 0.5 0.2 0.2\n";
+    saveToFile(pathToTxt, originalLabels);
+    // one of two equal marks was erased and saved before the crash
+    saveToFile(pathToDupTxt, originalLabels);
+    ComparisonResult toAdd{1, cv::Rect2d(0.1, 0.1, 0.2, 0.2), 0.9, 0, "img", false};
+    ComparisonResult toRemove{0, cv::Rect2d(0.4, 0.4, 0.2, 0.2), 0, 0, "img", false};
+    ComparisonResult toRemoveDup{0, cv::Rect2d(0.4, 0.4, 0.2, 0.2), 0, 0, "dup", false};
+    saveToFile(pathToDuv, to_string(ComparisonResults{toAdd, toRemove, toRemoveDup}));
+    {
+        CureJournal journal(pathToDuv);
+        std::vector<int> erased;
+        ComparisonResults rs = comparisonResultsFromFile(pathToDuv, false);
+        journal.replay(rs, erased);
+        journal.record(CureJournal::kAccepted, 0);
+        journal.record(CureJournal::kErased, 1, 1);
+        journal.record(CureJournal::kErased, 2, 2);
+        // crash: the .txt edits were only in LabelCache
+    }
+    const bool lostBeforeReplay = (getFileContents(pathToTxt) == originalLabels);
+    size_t numReapplied = 0, numReappliedAgain = 0;
+    {
+        CureJournal journal(pathToDuv);
+        std::vector<int> erased;
+        ComparisonResults rs = comparisonResultsFromFile(pathToDuv, false);
+        journal.replay(rs, erased);
+        {
+            LabelCache labels(std::chrono::hours(1));
+            numReapplied = journal.reapplyLabelEdits(rs, dir, labels, "");
+        }
+        // edits are on disk now, another replay must not add or remove anything
+        LabelCache labels(std::chrono::hours(1));
+        numReappliedAgain = journal.reapplyLabelEdits(rs, dir, labels, "");
+    }
+    const LoadedDetections dets = loadedDetectionsFromFile(pathToTxt);
+    const LoadedDetections dupDets = loadedDetectionsFromFile(pathToDupTxt);
+    remove(pathToTxt.c_str());
+    remove(pathToDupTxt.c_str());
+    remove(pathToDuv.c_str());
+    remove((pathToDuv + ".journal").c_str());
+    rmdir(dir.c_str());
+    if (!lostBeforeReplay || numReapplied != 2 || numReappliedAgain != 0 || dets.size() != 1
+            || findDetection(dets, toAdd.toLoadedDet()) != 0 || dupDets.size() != 1) {
+        LOG(ERROR) << "runCureJournalReapplyTest: label edits were not re-applied exactly once, "
+                   << numReapplied << " and " << numReappliedAgain << " edits, " << dets.size() << " and "
+                   << dupDets.size() << " marks";
+        return -1;
+    }
+    return 0;
+}
+
+int runLabelCacheTest(const std::string& testsDir) {
+    const std::string pathToTxt = testsDir + "/label_cache_test.tmp.txt";
+    const std::string pathToBackup = pathToTxt + ".bak";
+    const std::string originalContents = "0 0.5 0.5 0.2 0.2";
+    saveToFile(pathToTxt, originalContents);
+    remove(pathToBackup.c_str());
+    LoadedDetections dets;
+    {
+        LabelCache cache(std::chrono::hours(1)); // only flushed on destruction
+        dets = cache.get(pathToTxt);
+        dets.push_back({1, cv::Rect2d(0.1, 0.1, 0.3, 0.3)});
+        cache.set(pathToTxt, dets, pathToBackup);
+        dets.erase(dets.begin());
+        cache.set(pathToTxt, dets, pathToBackup);
+        bool inMemory = (cache.get(pathToTxt).size() == 1 && getFileContents(pathToTxt) == originalContents);
+        if (!inMemory) {
+            LOG(ERROR) << "runLabelCacheTest: changes should be kept in memory until flush";
+            return -1;
+        }
+    }
+    bool saved = (getFileContents(pathToTxt) == to_string(dets) && getFileContents(pathToBackup) == originalContents);
+    remove(pathToTxt.c_str());
+    remove(pathToBackup.c_str());
+    if (!saved) {
+        LOG(ERROR) << "runLabelCacheTest: labels or backup were not written on destruction";
+        return -1;
+    }
+    return 0;
+}
+
+int runBoxMatchingTest(const std::string& testsDir) {
+    // iou matrix vs scalar iou, box counts not divisible by SIMD width
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> coord(0, 0.8), size(0, 0.3);
+    std::vector<cv::Rect2d> as, bs;
+    BoxesSoA a, b;
+    for (int i = 0; i < 13; ++i) {
+        as.emplace_back(coord(rng), coord(rng), size(rng), size(rng));
+        a.push_back(as.back());
+    }
+    for (int i = 0; i < 11; ++i) {
+        bs.emplace_back(coord(rng), coord(rng), size(rng), size(rng));
+        b.push_back(bs.back());
+    }
+    b.push_back(cv::Rect2d(0.5, 0.5, 0, 0)); // empty box
+    bs.push_back(cv::Rect2d(0.5, 0.5, 0, 0));
+    std::vector<float> ious;
+    iouMatrix(a, b, ious);
+    for (size_t i = 0; i < as.size(); ++i) {
+        for (size_t j = 0; j < bs.size(); ++j) {
+            float expected = intersectionOverUnion(as[i], bs[j]);
+            if (std::abs(ious[i * bs.size() + j] - expected) > 1e-5) {
+                LOG(ERROR) << "runBoxMatchingTest: iou of " << to_human_string(as[i]) << " and " << to_human_string(bs[j]) << " is " << expected
+                           << ", iouMatrix gives " << ious[i * bs.size() + j];
+                return -1;
+            }
+        }
+    }
+
+    // two marks overlapping one prediction: only one of them is detected, the other one is reported as missed
+    DarkHelp::PredictionResult prediction;
+    prediction.original_point = cv::Point2f(0.5, 0.5);
+    prediction.original_size = cv::Size2f(0.2, 0.2);
+    prediction.all_probabilities[0] = 0.9;
+    LoadedDetections marks = {{0, cv::Rect2d(0.41, 0.4, 0.2, 0.2), ""}, {0, cv::Rect2d(0.4, 0.4, 0.2, 0.2), ""}};
+    ComparisonResults rs = comparePredictions({prediction}, marks, "img");
+    // the closer mark is matched even though it's the second one
+    bool matchedOnce = (rs.size() == 2 && almostEqual(rs[0].prob, 0) && almostEqual(rs[1].prob, 0.9)
+                        && rs[1].iou > 0.999);
+    if (!matchedOnce) {
+        LOG(ERROR) << "runBoxMatchingTest: prediction should be matched with one closest mark:\n" << to_string(rs);
+        return -1;
+    }
+    return 0;
+}
+
+int runBoxGridTest(const std::string& testsDir) {
+    // crowded image: pairs found with the grid must be the same as with all-pairs iou matrix
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<float> coord(-0.05, 1), size(0.001, 0.04);
+    LoadedDetections dets;
+    for (int i = 0; i < 3000; ++i)
+        dets.push_back({int(rng() % 3), cv::Rect2d(coord(rng), coord(rng), size(rng), size(rng)), "img"});
+    dets.push_back({0, cv::Rect2d(0.2, 0.2, 0.7, 0.7), "img"}); // covers many cells
+    dets.push_back(dets[5]); // marked twice
+    const BoxesSoA boxes = boxesOf(dets);
+    std::vector<float> ious;
+    iouMatrix(boxes, boxes, ious);
+    std::vector<BoxMatch> pairs = overlappingPairs(boxes, boxes);
+    size_t numExpected = 0;
+    bool same = true;
+    for (size_t i = 0, k = 0; i < dets.size(); ++i) {
+        for (size_t j = 0; j < dets.size(); ++j) {
+            if (ious[i * dets.size() + j] > 0) {
+                ++numExpected;
+                same = same && k < pairs.size() && pairs[k].pred == int(i) && pairs[k].gt == int(j)
+                            && pairs[k].iou == ious[i * dets.size() + j];
+                ++k;
+            }
+        }
+    }
+    if (!same || pairs.size() != numExpected) {
+        LOG(ERROR) << "runBoxGridTest: grid found " << pairs.size() << " overlapping pairs, expected " << numExpected;
+        return -1;
+    }
+
+    BoxGrid grid(boxes);
+    for (int i = 0; i < int(dets.size()); i += 97) {
+        if (findDetection(dets, grid, dets[i]) != findDetection(dets, dets[i])) {
+            LOG(ERROR) << "runBoxGridTest: findDetection with grid didn't find " << dets[i].toHumanString();
+            return -1;
+        }
+    }
+    auto duplicates = findOverlappingPairs(dets);
+    if (duplicates.end() == std::find(duplicates.begin(), duplicates.end(), std::make_pair(5, int(dets.size()) - 1))) {
+        LOG(ERROR) << "runBoxGridTest: duplicate mark not found";
+        return -1;
+    }
+    return 0;
+}
+
+// prediction of class classId with probability prob
+static DarkHelp::PredictionResult testPrediction(int classId, float prob, const cv::Rect2d& bbox) {
+    DarkHelp::PredictionResult p;
+    p.original_point = cv::Point2f(bbox.x + bbox.width / 2, bbox.y + bbox.height / 2);
+    p.original_size = cv::Size2f(bbox.width, bbox.height);
+    p.best_class = classId;
+    p.best_probability = prob;
+    p.all_probabilities[classId] = prob;
+    return p;
+}
+
+int runEvaluationTest(const std::string& testsDir) {
+    const cv::Rect2d a(0.1, 0.1, 0.2, 0.2), b(0.6, 0.6, 0.2, 0.2), elsewhere(0.5, 0.1, 0.1, 0.1);
+    DetectionEvaluator perfect({"a", "b"});
+    perfect.addImage({testPrediction(0, 0.9, a), testPrediction(1, 0.8, b)}, {{0, a, ""}, {1, b, ""}});
+    perfect.addImage({testPrediction(1, 0.7, a)}, {{1, a, ""}});
+    // class 0: false positive with the highest score, then the detected mark; the second mark is missed
+    DetectionEvaluator evaluator({"a"});
+    evaluator.addImage({testPrediction(0, 0.9, a), testPrediction(0, 0.95, elsewhere)}, {{0, a, ""}});
+    evaluator.addImage({}, {{0, b, ""}});
+    // class ids out of names range are skipped instead of growing (or writing past) per-class tables
+    DetectionEvaluator withUnknown({"a"});
+    withUnknown.addImage({testPrediction(0, 0.9, a), testPrediction(100000, 0.9, b), testPrediction(-1, 0.9, b)},
+                         {{0, a, ""}, {-1, b, ""}, {100000, b, ""}});
+    if (!almostEqual(withUnknown.averagePrecision(0, 0), 1) || withUnknown.averagePrecision(100000, 0) >= 0
+            || withUnknown.report().find("100000") != std::string::npos) {
+        LOG(ERROR) << "runEvaluationTest: marks or predictions of unknown classes were counted, report:\n"
+                   << withUnknown.report();
+        return -1;
+    }
+    // low-score predictions count towards AP, but not towards the confusion matrix
+    DetectionEvaluator lowScore({"a"});
+    lowScore.addImage({testPrediction(0, 0.05, a)}, {{0, a, ""}});
+    if (!almostEqual(lowScore.averagePrecision(0, 0), 1) || lowScore.report().find("\na\t0\t1\n") == std::string::npos) {
+        LOG(ERROR) << "runEvaluationTest: prediction below " << kValidationProbThresh << " was handled wrong, report:\n"
+                   << lowScore.report();
+        return -1;
+    }
+    const std::string report = evaluator.report();
+    const bool ok = almostEqual(perfect.meanAveragePrecision(0), 1) && almostEqual(perfect.averagePrecision(1, 9), 1)
+            && almostEqual(evaluator.averagePrecision(0, 0), 0.25) && evaluator.averagePrecision(1, 0) < 0
+            && evaluator.numImages() == 2
+            && report.find("\na\t1\t1\n") != std::string::npos && report.find("\nnone\t1\t-\n") != std::string::npos;
+    if (!ok) {
+        LOG(ERROR) << "runEvaluationTest: unexpected metrics, AP = " << evaluator.averagePrecision(0, 0)
+                   << ", report:\n" << report;
+        return -1;
+    }
+    return 0;
+}
+
+int runRethresholdTest(const std::string& testsDir) {
+    const std::string dumpPath = testsDir + "/rethreshold_test.tmp.preds", duvPath = testsDir + "/rethreshold_test.tmp.duv.tsv";
+    const std::string image = testsDir + "masks_files/3";
+    const LoadedDetections marks = loadedDetectionsFromFile(image + ".txt");
+    if (marks.empty()) {
+        LOG(ERROR) << "runRethresholdTest: no marks in " << image << ".txt";
+        return -1;
+    }
+    // predictions: the first mark detected with low probability, plus one weak false positive
+    DarkHelp::PredictionResults predictions = {testPrediction(marks[0].classId, 0.1, marks[0].bbox),
+                                              testPrediction(0, 0.3, cv::Rect2d(0.9, 0.9, 0.05, 0.05))};
+    PredictionStore store(42, 0.005);
+    store.put(image, {1, 1, predictions});
+    store.save(dumpPath);
+
+    ValidationThresholds low;
+    low.prob = 0.05;
+    int status = rethresholdDuv(dumpPath, duvPath, low);
+    ComparisonResults rs = comparisonResultsFromFile(duvPath, false);
+    const bool lowOk = (0 == status && to_string(rs) == to_string(comparePredictions(predictions, marks, image, low))
+                        && rs.size() == marks.size() + 1 && almostEqual(rs[0].prob, 0.1));
+    rethresholdDuv(dumpPath, duvPath, ValidationThresholds());
+    rs = comparisonResultsFromFile(duvPath, false);
+    const bool defaultOk = (rs.size() == marks.size() + 1 && rs[0].isToRemove() && rs.back().isToAdd());
+    // .duvb keeps thresholds for cure
+    const std::string duvbPath = testsDir + "/rethreshold_test.tmp.duvb";
+    rethresholdDuv(dumpPath, duvbPath, low);
+    const ValidationThresholds saved = duvThresholds(duvbPath), fromTsv = duvThresholds(duvPath);
+    const bool binaryOk = (comparisonResultsFromFile(duvbPath, false).size() == marks.size() + 1
+                           && almostEqual(saved.prob, low.prob) && almostEqual(saved.iou, low.iou)
+                           && almostEqual(fromTsv.prob, kValidationProbThresh));
+    remove(dumpPath.c_str());
+    remove(duvPath.c_str());
+    remove(duvbPath.c_str());
+    if (!lowOk || !defaultOk || !binaryOk) {
+        LOG(ERROR) << "runRethresholdTest: .duv made from raw predictions doesn\'t match thresholds";
+        return -1;
+    }
+    return 0;
+}
+
+int runBoxTrackerTest(const std::string& testsDir) {
+    // random 4x4 blocks give corners to track; the next frame is the same texture moved by (kShiftX, kShiftY)
+    constexpr int kWidth = 160, kHeight = 120, kShiftX = 5, kShiftY = 3;
+    std::mt19937 rng(17);
+    cv::Mat texture(kHeight + kShiftY, kWidth + kShiftX, CV_8UC1);
+    for (int y = 0; y < texture.rows; ++y)
+        for (int x = 0; x < texture.cols; ++x)
+            texture.ptr<unsigned char>(y)[x] = 0;
+    for (int by = 0; by < texture.rows; by += 4) {
+        for (int bx = 0; bx < texture.cols; bx += 4) {
+            const unsigned char value = rng() % 256;
+            for (int y = by; y < std::min(by + 4, texture.rows); ++y)
+                for (int x = bx; x < std::min(bx + 4, texture.cols); ++x)
+                    texture.ptr<unsigned char>(y)[x] = value;
+        }
+    }
+    cv::Mat frame(kHeight, kWidth, CV_8UC1), shifted(kHeight, kWidth, CV_8UC1);
+    for (int y = 0; y < kHeight; ++y) {
+        for (int x = 0; x < kWidth; ++x) {
+            frame.ptr<unsigned char>(y)[x] = texture.ptr<unsigned char>(y + kShiftY)[x + kShiftX];
+            shifted.ptr<unsigned char>(y)[x] = texture.ptr<unsigned char>(y)[x];
+        }
+    }
+    // content of frame at (x, y) is at (x + kShiftX, y + kShiftY) in shifted
+    DarkHelp::PredictionResult box = testPrediction(0, 0.9, cv::Rect2d(0.25, 0.25, 0.3, 0.3));
+    box.rect = cv::Rect(40, 30, 48, 36);
+    BoxTracker tracker;
+    tracker.reset(frame, {box});
+    const DarkHelp::PredictionResults moved = tracker.update(shifted);
+    if (moved.size() != 1 || std::abs(moved[0].rect.x - (box.rect.x + kShiftX)) > 1
+            || std::abs(moved[0].rect.y - (box.rect.y + kShiftY)) > 1
+            || moved[0].rect.width != box.rect.width || moved[0].rect.height != box.rect.height
+            || std::abs(moved[0].original_point.x - (box.original_point.x + float(kShiftX) / kWidth)) > 0.01) {
+        LOG(ERROR) << "runBoxTrackerTest: box " << to_human_string(box.rect) << " should have moved by "
+                   << kShiftX << "," << kShiftY << ", got " << (moved.empty() ? "none" : to_human_string(moved[0].rect));
+        return -1;
+    }
+    return 0;
+}
+
+int runKeyframeSelectorTest(const std::string& testsDir) {
+    KeyframeSelector selector(3, 0);
+    const cv::Mat frame(48, 64, CV_8UC3, cv::Scalar(0, 0, 0));
+    std::string keyframes;
+    for (int i = 0; i < 7; ++i)
+        keyframes += selector.isKeyframe(frame) ? 'k' : '-';
+    if (keyframes != "k--k--k") {
+        LOG(ERROR) << "runKeyframeSelectorTest: expected keyframes k--k--k, got " << keyframes;
+        return -1;
+    }
+    return 0;
+}
+
+int runSimilarityTest(const std::string& testsDir) {
+    // 4x8 grayscale thumbnails: black and white
+    cv::Mat black(4, 8, CV_8UC1), white(4, 8, CV_8UC1);
+    for (int y = 0; y < 4; ++y) {
+        std::fill(black.ptr<unsigned char>(y), black.ptr<unsigned char>(y) + 8, 0);
+        std::fill(white.ptr<unsigned char>(y), white.ptr<unsigned char>(y) + 8, 255);
+    }
+    cv::Mat firstRowWhite = black.clone();
+    std::fill(firstRowWhite.ptr<unsigned char>(0), firstRowWhite.ptr<unsigned char>(0) + 8, 255);
+    const float same = thumbnailDiff(black, black), full = thumbnailDiff(black, white);
+    const float oneRow = thumbnailDiff(black, firstRowWhite);
+    // sum exceeds 0.1 after the first row, the rest is not looked at
+    const float stopped = thumbnailDiff(black, white, 0.1);
+    const float sizeMismatch = thumbnailDiff(black, cv::Mat(2, 8, CV_8UC1));
+    if (same != 0 || std::abs(full - 1) > 1e-6 || std::abs(oneRow - 0.25) > 1e-6 || std::abs(stopped - 0.25) > 1e-6
+            || sizeMismatch != 1) {
+        LOG(ERROR) << "runSimilarityTest: unexpected thumbnailDiff " << same << ", " << full << ", " << oneRow
+                   << ", " << stopped << ", " << sizeMismatch;
+        return -1;
+    }
+    // imgDiff averages over channels: one of three channels changed from black to white
+    cv::Mat color1(3, 5, CV_8UC3), color2(3, 5, CV_8UC3);
+    for (int y = 0; y < 3; ++y) {
+        for (int x = 0; x < 5 * 3; ++x) {
+            color1.ptr<unsigned char>(y)[x] = 0;
+            color2.ptr<unsigned char>(y)[x] = (x % 3 == 1) ? 255 : 0;
+        }
+    }
+    const float colorDiff = imgDiff(color1, color2);
+    if (std::abs(colorDiff - 1.f / 3) > 1e-6) {
+        LOG(ERROR) << "runSimilarityTest: imgDiff expected 1/3, got " << colorDiff;
+        return -1;
+    }
+    return 0;
+}
+
+int runDedupClustersTest(const std::string& testsDir) {
+    // 0 - 1 - 3 form a chain within distance 1; 5 equals 0; 0xFF00 is far from the rest
+    const std::vector<uint64_t> hashes = {0, 0xFF00, 1, 3, 0xFF000000, 0};
+    const std::vector<std::vector<size_t>> expected = {{0, 2, 3, 5}};
+    if (findDuplicateClusters(hashes, 1) != expected) {
+        LOG(ERROR) << "runDedupClustersTest: wrong clusters for distance 1";
+        return -1;
+    }
+    const std::vector<std::vector<size_t>> exact = {{0, 5}};
+    if (findDuplicateClusters(hashes, 0) != exact) {
+        LOG(ERROR) << "runDedupClustersTest: wrong clusters for distance 0";
+        return -1;
+    }
+    // slow pan: each hash is 1 bit away from the previous one, so they all form one cluster,
+    // but only images within distance 2 of a kept one are redundant
+    std::vector<uint64_t> pan;
+    for (int k = 0; k < 8; ++k)
+        pan.push_back((uint64_t(1) << k) - 1);
+    const std::vector<std::vector<size_t>> panClusters = findDuplicateClusters(pan, 2);
+    const std::vector<size_t> expectedRedundant = {1, 2, 4, 5, 7};
+    if (panClusters.size() != 1 || redundantDuplicates(panClusters[0], pan, 2) != expectedRedundant) {
+        LOG(ERROR) << "runDedupClustersTest: a chain of near-duplicates should keep every third image";
+        return -1;
+    }
+
+    // random hashes around a few centers: the table must find the same clusters as comparing all pairs
+    std::mt19937_64 rng(777);
+    std::vector<uint64_t> centers(20), randomHashes(1000);
+    for (uint64_t& c: centers)
+        c = rng();
+    for (uint64_t& h: randomHashes) {
+        h = centers[rng() % centers.size()];
+        for (int flips = rng() % 12; flips > 0; --flips)
+            h ^= uint64_t(1) << (rng() % 64);
+    }
+    // 3: exact chunk matches only, 9: up to 2 bits differ in a chunk
+    for (int distance: {3, 9}) {
+        std::vector<size_t> root(randomHashes.size());
+        std::iota(root.begin(), root.end(), 0);
+        std::function<size_t(size_t)> findRoot = [&](size_t i) {return root[i] == i ? i : findRoot(root[i]);};
+        for (size_t i = 0; i < randomHashes.size(); ++i) {
+            for (size_t j = 0; j < i; ++j) {
+                if (hammingDistance(randomHashes[i], randomHashes[j]) <= distance) {
+                    const size_t a = findRoot(i), b = findRoot(j);
+                    root[std::max(a, b)] = std::min(a, b);
+                }
+            }
+        }
+        std::map<size_t, std::vector<size_t>> byRoot;
+        for (size_t i = 0; i < randomHashes.size(); ++i)
+            byRoot[findRoot(i)].push_back(i);
+        std::vector<std::vector<size_t>> bruteForce;
+        for (const auto& r: byRoot)
+            if (r.second.size() > 1)
+                bruteForce.push_back(r.second);
+        if (findDuplicateClusters(randomHashes, distance) != bruteForce) {
+            LOG(ERROR) << "runDedupClustersTest: clusters for distance " << distance << " differ from brute force";
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int runJpegProbeTest(const std::string& testsDir) {
+    const JpegHeaderInfo real = probeJpegHeader(testsDir + "masks_files/1.jpg");
+    if (!real.error.empty() || real.width <= 0 || real.height <= 0) {
+        LOG(ERROR) << "runJpegProbeTest: failed to probe valid image: " << real.error;
+        return -1;
+    }
+
+    // SOI, APP0 (JFIF), SOF0 640x480, SOS, 2 bytes of data, EOI
+    const std::string header("\xFF\xD8" "\xFF\xE0\x00\x10" "JFIF\x00\x01\x01\x00\x00\x01\x00\x01\x00\x00"
+                             "\xFF\xC0\x00\x0B\x08\x01\xE0\x02\x80\x01\x01\x11\x00"
+                             "\xFF\xDA\x00\x08\x01\x01\x00\x00\x3F\x00" "\x12\x34", 45);
+    const std::string tmpPath = testsDir + "jpeg_probe_test.tmp.jpg";
+    saveToFile(tmpPath, header + "\xFF\xD9");
+    const JpegHeaderInfo synthetic = probeJpegHeader(tmpPath);
+    // EOI is far from the end of file, but the image is complete
+    const std::string trailer(100, 'x');
+    saveToFile(tmpPath, header + "\xFF\xD9" + trailer);
+    const JpegHeaderInfo withTrailer = probeJpegHeader(tmpPath);
+    saveToFile(tmpPath, header + trailer);
+    const JpegHeaderInfo truncatedWithTrailer = probeJpegHeader(tmpPath);
+    saveToFile(tmpPath, header);
+    const JpegHeaderInfo truncated = probeJpegHeader(tmpPath);
+    saveToFile(tmpPath, header.substr(0, 20));
+    const JpegHeaderInfo noSof = probeJpegHeader(tmpPath);
+    saveToFile(tmpPath, "not a jpeg");
+    const JpegHeaderInfo notJpeg = probeJpegHeader(tmpPath);
+    remove(tmpPath.c_str());
+    if (!synthetic.error.empty() || synthetic.width != 640 || synthetic.height != 480) {
+        LOG(ERROR) << "runJpegProbeTest: expected 640x480, got " << synthetic.width << "x" << synthetic.height
+                   << " " << synthetic.error;
+        return -1;
+    }
+    if (!withTrailer.error.empty() || withTrailer.bytesAfterEoi != trailer.size() || synthetic.bytesAfterEoi != 0) {
+        LOG(ERROR) << "runJpegProbeTest: expected " << trailer.size() << " bytes after EOI, got "
+                   << withTrailer.bytesAfterEoi << " " << withTrailer.error;
+        return -1;
+    }
+    if (truncated.error.empty() || truncatedWithTrailer.error.empty() || noSof.error.empty() || notJpeg.error.empty()) {
+        LOG(ERROR) << "runJpegProbeTest: broken files not detected";
+        return -1;
+    }
+    return 0;
+}
+
+int runDatasetEnumTest(const std::string& testsDir) {
+    // strings longer than the rest of the arena block go to a new block; earlier views stay valid
+    PathArena arena;
+    const std::string longName(700000, 'x');
+    std::string_view first = arena.add("first"), second = arena.add(longName), third = arena.add(longName + "y");
+    std::string_view joined = arena.add("dir/", "name");
+    if (first != "first" || second != longName || third != longName + "y" || joined != "dir/name" || arena.size() != 4) {
+        LOG(ERROR) << "runDatasetEnumTest: PathArena lost strings";
+        return -1;
+    }
+
+    const std::string dir = testsDir + "dataset_enum_test.tmp/";
+    createFolderIfDoesntExist(dir);
+    createFolderIfDoesntExist(dir + "sub.jpg");
+    const std::vector<std::string> files = {"b.jpg", "b.txt", "a.jpg", "a.txt", "c.jpg", "d.txt", "e.png"};
+    for (const std::string& f: files)
+        saveToFile(dir + f, "");
+    const DatasetDirListing listing = listDatasetDir(dir);
+    const std::vector<std::string> labeled = loadTrainImageFilenames(dir, true);
+    const std::vector<std::string> unlabeled = loadTrainImageFilenames(dir, false);
+    const size_t numEntries = listFilesInDir(dir).size();
+    for (const std::string& f: files)
+        remove((dir + f).c_str());
+    rmdir((dir + "sub.jpg").c_str());
+    rmdir(dir.c_str());
+
+    const std::vector<std::string> expectedLabeled = {"a", "b"}, expectedUnlabeled = {"c"};
+    if (labeled != expectedLabeled || unlabeled != expectedUnlabeled || numEntries != files.size() + 1) {
+        LOG(ERROR) << "runDatasetEnumTest: wrong pairing of images and labels";
+        return -1;
+    }
+    if (listing.orphanLabels.size() != 1 || listing.orphanLabels[0] != "d"
+            || listing.otherFiles.size() != 1 || listing.otherFiles[0] != "e.png") {
+        LOG(ERROR) << "runDatasetEnumTest: wrong orphan labels or other files";
+        return -1;
+    }
+    return 0;
+}
+
+int runMockDetectorTest(const std::string& testsDir) {
+    const std::string namesFile = testsDir + "mock_detector_test.names";
+    saveToFile(namesFile, "with_mask\nwithout_mask\n");
+    constexpr float kThreshold = 0.3;
+    std::unique_ptr<Detector> detector = createDetector(DetectorBackend::kMock, "", "", namesFile, kThreshold);
+    std::unique_ptr<Detector> another = createDetector(DetectorBackend::kMock, "", "", namesFile, kThreshold);
+    remove(namesFile.c_str());
+
+    std::mt19937 rng(25);
+    std::vector<cv::Mat> images;
+    for (int i = 0; i < 16; ++i) {
+        cv::Mat img(40 + i, 60, CV_8UC3);
+        for (int y = 0; y < img.rows; ++y)
+            std::generate(img.ptr<unsigned char>(y), img.ptr<unsigned char>(y) + img.cols * 3, [&] {return rng() % 256;});
+        images.push_back(img);
+    }
+    auto samePredictions = [](const DarkHelp::PredictionResults& a, const DarkHelp::PredictionResults& b) {
+        if (a.size() != b.size())
+            return false;
+        for (size_t i = 0; i < a.size(); ++i) {
+            if (a[i].best_class != b[i].best_class || a[i].best_probability != b[i].best_probability
+                    || a[i].rect != b[i].rect || a[i].name != b[i].name)
+                return false;
+        }
+        return true;
+    };
+    // batch gives the same as images one by one, and other instances agree
+    const std::vector<DarkHelp::PredictionResults> batch = detector->predictBatch(images);
+    if (batch.size() != images.size() || !detector->predictBatch({}).empty()) {
+        LOG(ERROR) << "runMockDetectorTest: got " << batch.size() << " results for " << images.size() << " images";
+        return -1;
+    }
+    size_t numPredictions = 0;
+    for (size_t i = 0; i < images.size(); ++i) {
+        if (!samePredictions(batch[i], detector->predict(images[i]))
+                || !samePredictions(batch[i], another->predict(images[i]))) {
+            LOG(ERROR) << "runMockDetectorTest: predictions for image " << i << " are not deterministic";
+            return -1;
+        }
+        for (const auto& p: batch[i]) {
+            if (p.best_probability < kThreshold || (p.name != "with_mask" && p.name != "without_mask")) {
+                LOG(ERROR) << "runMockDetectorTest: unexpected prediction " << p.name << " " << p.best_probability;
+                return -1;
+            }
+        }
+        numPredictions += batch[i].size();
+    }
+    if (0 == numPredictions || detector->fingerprint() != another->fingerprint()) {
+        LOG(ERROR) << "runMockDetectorTest: fingerprints differ or no predictions at all";
+        return -1;
+    }
+    return 0;
+}
+
 int runAllTests(const std::string& testsDataDir) {
     static const std::vector<std::function<int(const std::string&)>> funcsToTest = {
           &runIouTest
@@ -157,6 +973,25 @@ int runAllTests(const std::string& testsDataDir) {
         , &runCmpResultsFromStringTests
         , &runCmpResultsFromFileTests
         , &runDsLoadingTests
+        , &runPredictionStoreTest
+        , &runDuvBinaryTest
+        , &runDuvParserTest
+        , &runDatasetLabelsTest
+        , &runCureIndexTest
+        , &runCureJournalTest
+        , &runCureJournalReapplyTest
+        , &runLabelCacheTest
+        , &runBoxMatchingTest
+        , &runBoxGridTest
+        , &runEvaluationTest
+        , &runRethresholdTest
+        , &runBoxTrackerTest
+        , &runKeyframeSelectorTest
+        , &runSimilarityTest
+        , &runDedupClustersTest
+        , &runJpegProbeTest
+        , &runDatasetEnumTest
+        , &runMockDetectorTest
     };
 
     // check tests dir
@@ -3,16 +3,18 @@
 #include "easylogging++.h"
 #include "helpers.h"
 #include "du_common.h"
+#include "dataset_enum.h"
 
 int createEmptyTxtFiles(const std::string& pathToDataset) {
     auto path = addSlash(pathToDataset);
-    auto filenames = loadTrainImageFilenames(path, false);
+    const DatasetDirListing listing = listDatasetDir(path);
+    const std::vector<std::string_view>& filenames = listing.unlabeled;
     LOG(INFO) << "found " << filenames.size() << " unlabelled files in " << path;
     if (filenames.empty())
         return 0;
     int numFilesCreated = 0;
     for (const auto& f: filenames) {
-        std::string emptyFilePath = path + f + ".txt";
+        std::string emptyFilePath = path + std::string(f) + ".txt";
         std::ofstream output(emptyFilePath);
         if (output.is_open()) {
             ++numFilesCreated;
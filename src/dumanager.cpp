@@ -3,6 +3,15 @@
 #include <easylogging++.h>
 #include "cv_funcs.h"
 #include "helpers.h"
+#include "bounded_queue.h"
+#include "tracker.h"
+#include "parallel.h"
+#include "detector.h"
+#include <atomic>
+#include <memory>
+#include <chrono>
+#include <sstream>
+#include <thread>
 
 using namespace std;
 using namespace cv;
@@ -10,17 +19,51 @@ using namespace cv;
 constexpr bool kDrawNames = false;
 constexpr bool kDrawPercentage = true;
 
-void configureDarkHelp(DarkHelp& dh) {
-    dh.threshold                      = 0.35;
-    dh.include_all_names              = false;
-    dh.names_include_percentage       = true;
-    dh.annotation_include_duration    = false;
-    dh.annotation_include_timestamp   = false;
-    dh.sort_predictions               = DarkHelp::ESort::kAscending;
-}
+// predictions drawn on marked videos and images
+constexpr float kMarkThreshold = 0.35;
+
+// frame travelling through markVid pipeline
+struct VideoFrame {
+    int index;
+    cv::Mat frame;
+    DarkHelp::PredictionResults results;
+};
+
+// how many frames may wait between pipeline stages
+constexpr size_t kVideoQueueSize = 8;
+
+// time a pipeline stage spent on its own work, not counting waiting for other stages
+class StageStats {
+public:
+    explicit StageStats(const char* name) : name_(name) {}
+
+    // measure duration of func()
+    template<class F>
+    auto measure(F&& func) {
+        struct Timer {
+            StageStats& stats;
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            ~Timer() {stats.busySeconds_ += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();}
+        } timer{*this};
+        return func();
+    }
+    void countFrame() {++numFrames_;}
+    size_t numFramesDone() const {return numFrames_;}
+    std::string toString() const {
+        std::ostringstream ss;
+        ss << name_ << ": " << numFrames_ << " frames in " << busySeconds_ << " s, "
+           << (busySeconds_ > 0 ? numFrames_ / busySeconds_ : 0) << " fps";
+        return ss.str();
+    }
+
+private:
+    const char* name_;
+    size_t numFrames_ = 0;
+    double busySeconds_ = 0;
+};
 
 void markVid(const std::string& configFile, const std::string& weightsFile,
-            const std::string& namesFile, const std::string& inputFile) {
+            const std::string& namesFile, const std::string& inputFile, const MarkVidOptions& options) {
     cv::VideoCapture cap(inputFile);
     LOG_IF(!cap.isOpened(), FATAL) << "cant open video " << inputFile;
     float fps = cap.get(CAP_PROP_FPS);
@@ -31,30 +74,110 @@ void markVid(const std::string& configFile, const std::string& weightsFile,
     constexpr const char* outFilename = "darkutils_out.mp4";
     auto names = getFileContentsAsStringVector(namesFile);
 
-    DarkHelp darkhelp(configFile, weightsFile, namesFile);
-    configureDarkHelp(darkhelp);
+    std::unique_ptr<Detector> detector =
+            createDetector(options.detector.backend, configFile, weightsFile, namesFile, kMarkThreshold);
+    const size_t batchSize = std::max(1u, options.detector.batchSize);
 
     cv::VideoWriter videoWriter(outFilename, cv::VideoWriter::fourcc('M','J','P','G'), fps, vidSize);
-    int frameCount = 0;
-    // video
-    while (true) {
-        cv::Mat frame;
-        cap >> frame;
-        if (frame.empty())
-            break;
-        const auto results = darkhelp.predict(frame);
-        LOG(INFO) << (++frameCount) << "/" << totalFrames << ": " << results;
-
-        // cv::Mat output = darkhelp.annotate();
-        annotateCustom(frame, results, names, kDrawNames, kDrawPercentage);
-        videoWriter << frame;
+
+    // pipeline: capture thread -> inference (this thread) -> annotate & encode thread.
+    // Each stage handles frames in order, so the output keeps the order of the input
+    BoundedQueue<VideoFrame> decodedQueue(std::max(kVideoQueueSize, 2 * batchSize)), predictedQueue(kVideoQueueSize);
+    StageStats captureStats("capture"), inferenceStats("inference"), trackingStats("tracking"),
+               encodeStats("annotate+encode");
+    // frames between keyframes get boxes from the tracker instead of the network
+    KeyframeSelector keyframes(options.keyframeInterval, options.motionThresh);
+    BoxTracker tracker;
+    const bool everyFrame = (options.keyframeInterval <= 1 && options.motionThresh <= 0);
+    const auto start = std::chrono::steady_clock::now();
+
+    std::thread capture([&] {
+        for (int index = 0; ; ++index) {
+            VideoFrame vf{index, {}, {}};
+            captureStats.measure([&] {cap >> vf.frame;});
+            if (vf.frame.empty())
+                break;
+            captureStats.countFrame();
+            if (!decodedQueue.push(std::move(vf)))
+                break;
+        }
+        decodedQueue.close();
+    });
+
+    std::thread encoder([&] {
+        VideoFrame vf;
+        while (predictedQueue.pop(vf)) {
+            encodeStats.measure([&] {
+                annotateCustom(vf.frame, vf.results, names, kDrawNames, kDrawPercentage);
+                videoWriter << vf.frame;
+            });
+            encodeStats.countFrame();
+        }
+    });
+
+    // take up to batchSize frames at once: their keyframes go to the network as one batch,
+    // then frames are handed to the tracker in order
+    std::vector<VideoFrame> window;
+    std::vector<char> isKeyframe;
+    std::vector<cv::Mat> keyframeImages;
+    while (decodedQueue.popBatch(window, batchSize)) {
+        isKeyframe.clear();
+        keyframeImages.clear();
+        for (const VideoFrame& vf: window) {
+            isKeyframe.push_back(everyFrame || keyframes.isKeyframe(vf.frame));
+            if (isKeyframe.back())
+                keyframeImages.push_back(vf.frame);
+        }
+        std::vector<DarkHelp::PredictionResults> keyframeResults;
+        if (!keyframeImages.empty()) {
+            keyframeResults = inferenceStats.measure([&] {return detector->predictBatch(keyframeImages);});
+            for (size_t i = 0; i < keyframeImages.size(); ++i)
+                inferenceStats.countFrame();
+        }
+        auto nextResults = keyframeResults.begin();
+        for (size_t i = 0; i < window.size(); ++i) {
+            VideoFrame& vf = window[i];
+            if (isKeyframe[i]) {
+                vf.results = std::move(*nextResults++);
+                if (!everyFrame)
+                    tracker.reset(vf.frame, vf.results);
+            } else {
+                vf.results = trackingStats.measure([&] {return tracker.update(vf.frame);});
+                trackingStats.countFrame();
+            }
+            LOG(INFO) << (vf.index + 1) << "/" << totalFrames << (isKeyframe[i] ? ": " : " (tracked): ") << vf.results;
+            predictedQueue.push(std::move(vf));
+        }
     }
+    predictedQueue.close();
+    capture.join();
+    encoder.join();
     cap.release();
+    videoWriter.release();
+
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    LOG(INFO) << captureStats.toString();
+    LOG(INFO) << inferenceStats.toString();
+    LOG_IF(!everyFrame, INFO) << trackingStats.toString();
+    LOG(INFO) << encodeStats.toString();
+    const size_t numFrames = encodeStats.numFramesDone();
+    LOG(INFO) << "overall: " << numFrames << " frames in " << seconds << " s, "
+              << (seconds > 0 ? numFrames / seconds : 0) << " fps";
     LOG(INFO) << "Annotated file created: " << outFilename;
 }
 
+// image travelling through markImgs pipeline
+struct MarkedImage {
+    std::string filename;
+    cv::Mat img;
+    DarkHelp::PredictionResults results;
+};
+
+// how many images per inference worker may wait for inference or for encoding
+constexpr size_t kImagesQueuedPerWorker = 8;
+
 void markImgs(const std::string& configFile, const std::string& weightsFile,
-            const std::string& namesFile, std::string pathToImgs) {
+            const std::string& namesFile, std::string pathToImgs, const MarkImgsOptions& options) {
     pathToImgs = addSlash(pathToImgs);
     vector<string> imgFiles = listFilesInDir(pathToImgs);
     imgFiles.erase(
@@ -69,28 +192,72 @@ void markImgs(const std::string& configFile, const std::string& weightsFile,
     LOG_IF(!createdOrExists, FATAL) << "failed to create folder: " << pathToResults;
     auto names = getFileContentsAsStringVector(namesFile);
 
-    DarkHelp darkhelp(configFile, weightsFile, namesFile);
-    configureDarkHelp(darkhelp);
+    const unsigned numWorkers = std::max(1u, options.numWorkers);
+    const size_t batchSize = std::max(1u, options.detector.batchSize);
+    std::vector<std::unique_ptr<Detector>> detectors;
+    for (unsigned w = 0; w < numWorkers; ++w)
+        detectors.push_back(createDetector(options.detector.backend, configFile, weightsFile, namesFile, kMarkThreshold));
 
-    int numImgsSaved = 0, imgIndex = 0;
-    for (const auto& fn: imgFiles) {
-        auto fullPath = pathToImgs + fn;
-        cv::Mat img = imread(fullPath);
-        if (nullptr == img.data) {
-            LOG(ERROR) << "failed to load image " << fullPath;
-            continue;
-        }
-        const auto results = darkhelp.predict(img);
-        annotateCustom(img, results, names, kDrawNames, kDrawPercentage);
-        std::string outputImgPath = pathToResults + fn;
-        LOG(INFO) << (++imgIndex) << "/" << imgFiles.size() << " " << fn << ": " << results;
-        bool saved = imwrite(outputImgPath, img);
-
-        if (saved)
-            ++numImgsSaved;
-        else
-            LOG(ERROR) << "failed to save image to";
+    // pipeline: decoder threads -> inference workers -> annotate & encode threads.
+    // Images are independent, so they're processed in whatever order they come out of each stage
+    const unsigned numIoThreads = std::max(1u, defaultNumThreads() / 2);
+    BoundedQueue<MarkedImage> decodedQueue(std::max(kImagesQueuedPerWorker, 2 * batchSize) * numWorkers);
+    BoundedQueue<MarkedImage> predictedQueue(kImagesQueuedPerWorker * numWorkers);
+    std::atomic<size_t> nextToDecode{0}, imgIndex{0}, numImgsSaved{0};
+    std::atomic<unsigned> activeDecoders{numIoThreads}, activeWorkers{numWorkers};
+    std::vector<std::thread> threads;
+
+    for (unsigned t = 0; t < numIoThreads; ++t) {
+        threads.emplace_back([&] {
+            for (size_t i = nextToDecode++; i < imgFiles.size(); i = nextToDecode++) {
+                auto fullPath = pathToImgs + imgFiles[i];
+                cv::Mat img = imread(fullPath);
+                if (nullptr == img.data) {
+                    LOG(ERROR) << "failed to load image " << fullPath;
+                    continue;
+                }
+                if (!decodedQueue.push({imgFiles[i], img, {}}))
+                    break;
+            }
+            if (--activeDecoders == 0)
+                decodedQueue.close();
+        });
+    }
+    for (unsigned w = 0; w < numWorkers; ++w) {
+        threads.emplace_back([&, w] {
+            std::vector<MarkedImage> batch;
+            std::vector<cv::Mat> images;
+            while (decodedQueue.popBatch(batch, batchSize)) {
+                images.clear();
+                for (const MarkedImage& mi: batch)
+                    images.push_back(mi.img);
+                std::vector<DarkHelp::PredictionResults> results = detectors[w]->predictBatch(images);
+                for (size_t i = 0; i < batch.size(); ++i) {
+                    MarkedImage& mi = batch[i];
+                    mi.results = std::move(results[i]);
+                    LOG(INFO) << (++imgIndex) << "/" << imgFiles.size() << " " << mi.filename << ": " << mi.results;
+                    predictedQueue.push(std::move(mi));
+                }
+            }
+            if (--activeWorkers == 0)
+                predictedQueue.close();
+        });
+    }
+    for (unsigned t = 0; t < numIoThreads; ++t) {
+        threads.emplace_back([&] {
+            MarkedImage mi;
+            while (predictedQueue.pop(mi)) {
+                annotateCustom(mi.img, mi.results, names, kDrawNames, kDrawPercentage);
+                std::string outputImgPath = pathToResults + mi.filename;
+                if (imwrite(outputImgPath, mi.img))
+                    ++numImgsSaved;
+                else
+                    LOG(ERROR) << "failed to save image to " << outputImgPath;
+            }
+        });
     }
+    for (auto& t: threads)
+        t.join();
 
     LOG(INFO) << "marked and saved " << numImgsSaved << " images to " << pathToResults;
 }
@@ -1,13 +1,31 @@
 #ifndef DUMANAGER_H
 #define DUMANAGER_H
 
+#include "detector.h"
 #include <string>
 using std::string;
 
+struct MarkVidOptions {
+    // run the network on every keyframeInterval-th frame; boxes on frames in between are moved by BoxTracker
+    int keyframeInterval = 1;
+    // also run the network when frame differs from the last keyframe by more than this (0..1, 0 = never)
+    float motionThresh = 0;
+    // keyframes of up to detector.batchSize consecutive frames are predicted together
+    DetectorOptions detector;
+};
+
 void markVid(const std::string& configFile, const std::string& weightsFile,
-            const std::string& namesFile, const std::string& inputFile);
+            const std::string& namesFile, const std::string& inputFile,
+            const MarkVidOptions& options = MarkVidOptions());
+
+struct MarkImgsOptions {
+    // number of network instances; images are decoded and encoded by a pool of threads around them
+    unsigned numWorkers = 1;
+    DetectorOptions detector;
+};
 
 void markImgs(const std::string& configFile, const std::string& weightsFile,
-              const std::string& namesFile, std::string pathToImgs);
+              const std::string& namesFile, std::string pathToImgs,
+              const MarkImgsOptions& options = MarkImgsOptions());
 
 #endif // DUMANAGER_H
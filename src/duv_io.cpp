@@ -0,0 +1,308 @@
+#include "duv_io.h"
+#include "easylogging++.h"
+#include <charconv>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <unordered_map>
+
+constexpr size_t DuvWriter::kFlushSize;
+constexpr std::chrono::seconds DuvWriter::kFlushInterval;
+
+DuvWriter::DuvWriter(const std::string& path, bool append)
+    : path_(path), file_(fopen(path.c_str(), append ? "ab" : "wb")), lastFlush_(std::chrono::steady_clock::now()) {
+    buffer_.reserve(kFlushSize + (64 << 10));
+}
+
+DuvWriter::~DuvWriter() {
+    if (nullptr == file_)
+        return;
+    flush();
+    fclose(file_);
+}
+
+void DuvWriter::write(const ComparisonResult& result) {
+    result.appendTo(buffer_);
+    buffer_ += '\n';
+    flushIfNeeded();
+}
+
+void DuvWriter::write(const ComparisonResults& results) {
+    for (const auto& r: results) {
+        r.appendTo(buffer_);
+        buffer_ += '\n';
+    }
+    flushIfNeeded();
+}
+
+void DuvWriter::flushIfNeeded() {
+    if (buffer_.size() >= kFlushSize || std::chrono::steady_clock::now() - lastFlush_ >= kFlushInterval)
+        flush();
+}
+
+bool DuvWriter::flush() {
+    lastFlush_ = std::chrono::steady_clock::now();
+    if (nullptr == file_ || buffer_.empty())
+        return nullptr != file_;
+    bool written = (buffer_.size() == fwrite(buffer_.data(), 1, buffer_.size(), file_)) && (0 == fflush(file_));
+    LOG_IF(!written, ERROR) << "failed to write .duv rows to " << path_;
+    buffer_.clear(); // keeps capacity
+    return written;
+}
+
+// cut the next tab-separated field from line
+static std::string_view nextField(std::string_view& line) {
+    size_t tab = line.find('\t');
+    std::string_view field = line.substr(0, tab);
+    line.remove_prefix(std::string_view::npos == tab ? line.size() : tab + 1);
+    return field;
+}
+
+// parse the whole field as number
+template<class T>
+static bool parseField(std::string_view& line, T& value) {
+    std::string_view field = nextField(line);
+    auto res = std::from_chars(field.data(), field.data() + field.size(), value);
+    return res.ec == std::errc() && res.ptr == field.data() + field.size();
+}
+
+bool parseDuvLine(std::string_view line, ComparisonResult& r) {
+    if (!line.empty() && line.back() == '\r')
+        line.remove_suffix(1);
+    std::string_view filename = nextField(line);
+    float midX, midY, width, height;
+    if (!parseField(line, r.classId) || !parseField(line, midX) || !parseField(line, midY)
+            || !parseField(line, width) || !parseField(line, height)
+            || !parseField(line, r.prob) || !parseField(line, r.iou))
+        return false;
+    std::string_view treated = nextField(line);
+    if (!line.empty() || (treated != "t" && treated != "f"))
+        return false;
+    r.filename.assign(filename.data(), filename.size());
+    r.bbox = cv::Rect2d(midX - width/2, midY - height/2, width, height);
+    r.treated = (treated == "t");
+    return true;
+}
+
+size_t parseDuvBuffer(std::string_view buf, ComparisonResults& results, bool ignoreTreatedDets,
+                      const std::string& sourceName) {
+    size_t numMalformed = 0, lineNumber = 0;
+    ComparisonResult r;
+    while (!buf.empty()) {
+        ++lineNumber;
+        size_t eol = buf.find('\n');
+        std::string_view line = buf.substr(0, eol);
+        buf.remove_prefix(std::string_view::npos == eol ? buf.size() : eol + 1);
+        if (!parseDuvLine(line, r) || !r.isValid()) {
+            LOG(ERROR) << "Can not parse line #" << lineNumber << " of " << sourceName << " to ComparisonResults: "
+                       << line;
+            ++numMalformed;
+        } else if (!ignoreTreatedDets || !r.treated) {
+            results.push_back(r);
+        }
+    }
+    return numMalformed;
+}
+
+// "darkutils validation, binary"
+static const char kDuvBinaryMagic[4] = {'D', 'U', 'V', 'B'};
+constexpr uint32_t kDuvBinaryVersion = 1;
+
+// round up to multiple of 8
+static uint64_t aligned(uint64_t offset) {
+    return (offset + 7) & ~uint64_t(7);
+}
+
+bool isDuvBinaryFile(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    char magic[sizeof(kDuvBinaryMagic)];
+    return file.read(magic, sizeof(magic)) && 0 == memcmp(magic, kDuvBinaryMagic, sizeof(magic));
+}
+
+template<class T>
+static void writeColumn(std::ofstream& file, const std::vector<T>& values, uint64_t offset) {
+    file.seekp(offset);
+    file.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+}
+
+bool saveDuvBinary(const std::string& path, const ComparisonResults& results, const DuvBinaryInfo& info) {
+    const size_t n = results.size();
+    std::vector<int32_t> classIds(n);
+    std::vector<float> xs(n), ys(n), ws(n), hs(n), probs(n), ious(n);
+    std::vector<uint32_t> filenameIndices(n);
+    std::vector<uint8_t> treated(n);
+    // filename table; rows of the same image usually go one after another
+    std::unordered_map<std::string, uint32_t> filenameIndex;
+    std::vector<uint64_t> filenameOffsets{0};
+    std::string filenameChars;
+    for (size_t i = 0; i < n; ++i) {
+        const ComparisonResult& r = results[i];
+        classIds[i] = r.classId;
+        xs[i] = r.bbox.x;
+        ys[i] = r.bbox.y;
+        ws[i] = r.bbox.width;
+        hs[i] = r.bbox.height;
+        probs[i] = r.prob;
+        ious[i] = r.iou;
+        treated[i] = r.treated;
+        if (i > 0 && r.filename == results[i-1].filename) {
+            filenameIndices[i] = filenameIndices[i-1];
+            continue;
+        }
+        auto inserted = filenameIndex.emplace(r.filename, uint32_t(filenameOffsets.size() - 1));
+        if (inserted.second) {
+            filenameChars += r.filename;
+            filenameOffsets.push_back(filenameChars.size());
+        }
+        filenameIndices[i] = inserted.first->second;
+    }
+
+    DuvBinaryHeader h{};
+    memcpy(h.magic, kDuvBinaryMagic, sizeof(h.magic));
+    h.version = kDuvBinaryVersion;
+    h.numRows = n;
+    h.numFilenames = filenameOffsets.size() - 1;
+    h.probThresh = info.probThresh;
+    h.iouThresh = info.iouThresh;
+    h.modelFingerprint = info.modelFingerprint;
+    uint64_t offset = aligned(sizeof(h));
+    for (uint64_t* section: {&h.classIdOffset, &h.xOffset, &h.yOffset, &h.wOffset, &h.hOffset,
+                             &h.probOffset, &h.iouOffset, &h.filenameIndexOffset}) {
+        *section = offset;
+        offset = aligned(offset + n * 4);
+    }
+    h.treatedOffset = offset;
+    h.filenameOffsetsOffset = aligned(h.treatedOffset + n);
+    h.filenameCharsOffset = h.filenameOffsetsOffset + filenameOffsets.size() * sizeof(uint64_t);
+    h.fileSize = h.filenameCharsOffset + filenameChars.size();
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        LOG(ERROR) << "can not open " << path << " for writing";
+        return false;
+    }
+    file.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    writeColumn(file, classIds, h.classIdOffset);
+    writeColumn(file, xs, h.xOffset);
+    writeColumn(file, ys, h.yOffset);
+    writeColumn(file, ws, h.wOffset);
+    writeColumn(file, hs, h.hOffset);
+    writeColumn(file, probs, h.probOffset);
+    writeColumn(file, ious, h.iouOffset);
+    writeColumn(file, filenameIndices, h.filenameIndexOffset);
+    writeColumn(file, treated, h.treatedOffset);
+    writeColumn(file, filenameOffsets, h.filenameOffsetsOffset);
+    file.seekp(h.filenameCharsOffset);
+    file.write(filenameChars.data(), filenameChars.size());
+    LOG_IF(!file.good(), ERROR) << "failed to write " << path;
+    return file.good();
+}
+
+bool saveComparisonResults(const std::string& path, const ComparisonResults& results) {
+    if (!isDuvBinaryPath(path))
+        return saveToFileAtomic(path, to_string(results));
+    DuvBinaryInfo info;
+    if (isDuvBinaryFile(path)) {
+        DuvBinaryView old(path);
+        if (old.isValid())
+            info = old.info();
+    }
+    // write next to the old file and replace it, since the old file may be mapped by somebody
+    const std::string tmpPath = path + ".tmp";
+    return saveDuvBinary(tmpPath, results, info) && 0 == rename(tmpPath.c_str(), path.c_str());
+}
+
+DuvBinaryView::DuvBinaryView(const std::string& path) : file_(new MappedFile(path)) {
+    if (!file_->isOpen() || file_->size() < sizeof(DuvBinaryHeader)) {
+        LOG(ERROR) << "can not map .duvb file " << path;
+        return;
+    }
+    const DuvBinaryHeader* h = reinterpret_cast<const DuvBinaryHeader*>(file_->data());
+    const uint64_t fileSize = file_->size();
+    // written so that damaged counts or offsets can not overflow the checks
+    auto sectionFits = [fileSize](uint64_t offset, uint64_t count, uint64_t elemSize) {
+        return offset % 8 == 0 && offset <= fileSize && count <= (fileSize - offset) / elemSize;
+    };
+    const uint64_t n = h->numRows;
+    bool sectionsFit = h->fileSize == fileSize && h->numFilenames < std::numeric_limits<uint64_t>::max();
+    for (uint64_t offset: {h->classIdOffset, h->xOffset, h->yOffset, h->wOffset, h->hOffset,
+                           h->probOffset, h->iouOffset, h->filenameIndexOffset})
+        sectionsFit = sectionsFit && sectionFits(offset, n, 4);
+    sectionsFit = sectionsFit && h->treatedOffset <= fileSize && n <= fileSize - h->treatedOffset
+            && sectionFits(h->filenameOffsetsOffset, h->numFilenames + 1, sizeof(uint64_t))
+            && h->filenameCharsOffset == h->filenameOffsetsOffset + (h->numFilenames + 1) * sizeof(uint64_t)
+            && h->filenameCharsOffset <= fileSize;
+    if (sectionsFit) {
+        const uint64_t* offsets = reinterpret_cast<const uint64_t*>(file_->data() + h->filenameOffsetsOffset);
+        sectionsFit = offsets[h->numFilenames] <= fileSize - h->filenameCharsOffset;
+    }
+    if (0 != memcmp(h->magic, kDuvBinaryMagic, sizeof(h->magic)) || h->version != kDuvBinaryVersion || !sectionsFit) {
+        LOG(ERROR) << path << " is not a valid .duvb file";
+        return;
+    }
+    header_ = h;
+}
+
+ValidationThresholds duvThresholds(const std::string& path) {
+    ValidationThresholds thresholds;
+    if (isDuvBinaryFile(path)) {
+        DuvBinaryView view(path);
+        if (view.isValid()) {
+            thresholds.prob = view.info().probThresh;
+            thresholds.iou = view.info().iouThresh;
+        }
+    }
+    return thresholds;
+}
+
+DuvBinaryInfo DuvBinaryView::info() const {
+    return DuvBinaryInfo{header_->probThresh, header_->iouThresh, header_->modelFingerprint};
+}
+
+cv::Rect2d DuvBinaryView::bbox(size_t row) const {
+    return cv::Rect2d(column<float>(header_->xOffset)[row], column<float>(header_->yOffset)[row],
+                      column<float>(header_->wOffset)[row], column<float>(header_->hOffset)[row]);
+}
+
+std::string_view DuvBinaryView::filename(size_t row) const {
+    const uint32_t index = column<uint32_t>(header_->filenameIndexOffset)[row];
+    if (index >= header_->numFilenames)
+        return std::string_view();
+    const uint64_t* offsets = column<uint64_t>(header_->filenameOffsetsOffset);
+    const uint64_t begin = std::min(offsets[index], header_->fileSize - header_->filenameCharsOffset);
+    const uint64_t end = std::min(std::max(begin, offsets[index + 1]), header_->fileSize - header_->filenameCharsOffset);
+    return std::string_view(file_->data() + header_->filenameCharsOffset + begin, end - begin);
+}
+
+ComparisonResult DuvBinaryView::row(size_t row) const {
+    return ComparisonResult{classIds()[row], bbox(row), probs()[row], ious()[row],
+                            std::string(filename(row)), treated()[row] != 0};
+}
+
+ComparisonResults DuvBinaryView::toComparisonResults(bool ignoreTreatedDets) const {
+    ComparisonResults results;
+    results.reserve(size());
+    for (size_t i = 0; i < size(); ++i) {
+        if (ignoreTreatedDets && treated()[i])
+            continue;
+        ComparisonResult r = row(i);
+        if (!r.isValid())
+            LOG(ERROR) << "Invalid row #" << i << " in .duvb: " << r.toString();
+        else
+            results.push_back(std::move(r));
+    }
+    return results;
+}
+
+int convertDuv(const std::string& inputPath, const std::string& outputPath, const DuvBinaryInfo& info) {
+    ComparisonResults results = comparisonResultsFromFile(inputPath, false);
+    if (results.empty()) {
+        LOG(ERROR) << "no results loaded from " << inputPath;
+        return -1;
+    }
+    bool saved = isDuvBinaryPath(outputPath) ? saveDuvBinary(outputPath, results, info)
+                                             : saveToFile(outputPath, to_string(results));
+    LOG_IF(saved, INFO) << "converted " << results.size() << " results from " << inputPath << " to " << outputPath;
+    LOG_IF(!saved, ERROR) << "failed to save " << outputPath;
+    return saved ? 0 : -1;
+}
@@ -0,0 +1,125 @@
+#ifndef DUV_IO_H
+#define DUV_IO_H
+
+#include "du_common.h"
+#include "helpers.h"
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <string_view>
+
+// Streams .duv rows to a file through one open handle.
+// Rows are formatted into a reusable buffer, which is written out when it grows over kFlushSize bytes
+// or when kFlushInterval has passed since the last write, so a crash loses at most one batch.
+class DuvWriter {
+public:
+    static constexpr size_t kFlushSize = 4 << 20;
+    static constexpr std::chrono::seconds kFlushInterval{5};
+
+    // opens file for writing; if append == false, file is truncated
+    explicit DuvWriter(const std::string& path, bool append = false);
+    // flushes and closes the file
+    ~DuvWriter();
+    DuvWriter(const DuvWriter&) = delete;
+    DuvWriter& operator=(const DuvWriter&) = delete;
+
+    bool isOpen() const {return nullptr != file_;}
+    void write(const ComparisonResult& result);
+    void write(const ComparisonResults& results);
+    // write buffered rows to file. Returns false on write error
+    bool flush();
+
+private:
+    void flushIfNeeded();
+
+    std::string path_;
+    FILE* file_ = nullptr;
+    std::string buffer_;
+    std::chrono::steady_clock::time_point lastFlush_;
+};
+
+// Parse one tab-separated .duv row "filename c x y w h p iou treated" without intermediate strings.
+// Returns false if the line is malformed; then r is left in unspecified state
+bool parseDuvLine(std::string_view line, ComparisonResult& r);
+
+// Parse all rows of .duv text in place, appending them to results (skips treated rows if ignoreTreatedDets).
+// Malformed and invalid rows are reported with line numbers and skipped.
+// sourceName is used in error messages. Returns number of skipped malformed rows
+size_t parseDuvBuffer(std::string_view buf, ComparisonResults& results, bool ignoreTreatedDets,
+                      const std::string& sourceName);
+
+// Binary columnar variant of .duv (.duvb). Layout, host byte order, every section 8-byte aligned:
+// DuvBinaryHeader, then columns of numRows elements: int32 classId, float32 x, y, w, h (relative bbox,
+// x,y is top-left corner), float32 prob, float32 iou, uint32 filename index, uint8 treated;
+// then filename table: uint64 offsets[numFilenames + 1] into the chars section that follows.
+struct DuvBinaryHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t numRows;
+    uint64_t numFilenames;
+    float probThresh;
+    float iouThresh;
+    uint64_t modelFingerprint; // 0 if unknown
+    // section offsets from the beginning of file
+    uint64_t classIdOffset, xOffset, yOffset, wOffset, hOffset, probOffset, iouOffset;
+    uint64_t filenameIndexOffset, treatedOffset, filenameOffsetsOffset, filenameCharsOffset;
+    uint64_t fileSize;
+};
+
+// values stored in the .duvb header besides the rows
+struct DuvBinaryInfo {
+    float probThresh = kValidationProbThresh;
+    float iouThresh = kStrongIntersectionThresh;
+    uint64_t modelFingerprint = 0;
+};
+
+// returns true if path has .duvb extension
+inline bool isDuvBinaryPath(const std::string& path) {return strEndsWith(path, ".duvb");}
+
+// returns true if file starts with .duvb signature
+bool isDuvBinaryFile(const std::string& path);
+
+// write results in .duvb format. Returns true if successful
+bool saveDuvBinary(const std::string& path, const ComparisonResults& results, const DuvBinaryInfo& info = DuvBinaryInfo());
+
+// save results to .duvb if path has .duvb extension, otherwise to tab-separated .duv.
+// The file is replaced atomically. When overwriting .duvb, thresholds and model fingerprint from the old header are kept
+bool saveComparisonResults(const std::string& path, const ComparisonResults& results);
+
+// convert .duv to .duvb or back, depending on extension of outputPath. Returns 0 if successful
+int convertDuv(const std::string& inputPath, const std::string& outputPath, const DuvBinaryInfo& info);
+
+// thresholds rows of .duv were compared with: from the header of .duvb, defaults for tab-separated .duv
+ValidationThresholds duvThresholds(const std::string& path);
+
+// Memory-mapped .duvb file. Columns are accessed in place, without parsing
+class DuvBinaryView {
+public:
+    explicit DuvBinaryView(const std::string& path);
+
+    // false if file can't be mapped or its header is inconsistent with the file
+    bool isValid() const {return nullptr != header_;}
+    size_t size() const {return header_->numRows;}
+    DuvBinaryInfo info() const;
+
+    const int32_t* classIds() const {return column<int32_t>(header_->classIdOffset);}
+    const float* probs() const {return column<float>(header_->probOffset);}
+    const float* ious() const {return column<float>(header_->iouOffset);}
+    const uint8_t* treated() const {return column<uint8_t>(header_->treatedOffset);}
+    cv::Rect2d bbox(size_t row) const;
+    std::string_view filename(size_t row) const;
+    ComparisonResult row(size_t row) const;
+    // convert all rows, optionally skipping treated ones
+    ComparisonResults toComparisonResults(bool ignoreTreatedDets) const;
+
+private:
+    template<class T>
+    const T* column(uint64_t offset) const {return reinterpret_cast<const T*>(file_->data() + offset);}
+
+    std::unique_ptr<MappedFile> file_;
+    const DuvBinaryHeader* header_ = nullptr;
+};
+
+#endif // DUV_IO_H
@@ -0,0 +1,288 @@
+#include "evaluation.h"
+#include "box_matching.h"
+#include "easylogging++.h"
+#include <algorithm>
+#include <iomanip>
+#include <iterator>
+#include <sstream>
+
+// score thresholds of precision-recall curves in the report
+constexpr float kPrCurveStep = 0.05;
+
+std::vector<float> DetectionEvaluator::defaultIouThresholds() {
+    std::vector<float> thresholds;
+    for (int i = 0; i < 10; ++i)
+        thresholds.push_back(0.5f + 0.05f * i);
+    return thresholds;
+}
+
+DetectionEvaluator::DetectionEvaluator(std::vector<std::string> classNames, std::vector<float> iouThresholds)
+    : classNames_(std::move(classNames)), iouThresholds_(std::move(iouThresholds)) {
+    if (!classNames_.empty())
+        ensureClass(classNames_.size() - 1);
+}
+
+void DetectionEvaluator::ensureClass(int classId) {
+    const size_t n = classId + 1;
+    if (classes_.size() >= n)
+        return;
+    classes_.resize(n);
+    for (auto& c: classes_)
+        c.detections.resize(iouThresholds_.size());
+    confusion_.resize(n);
+    for (auto& row: confusion_)
+        row.resize(n, 0);
+    missed_.resize(n, 0);
+    unmatched_.resize(n, 0);
+}
+
+bool DetectionEvaluator::isKnownClass(int classId) const {
+    return classId >= 0 && classId < int(classNames_.size());
+}
+
+void DetectionEvaluator::addImage(const DarkHelp::PredictionResults& allPredictions,
+                                  const LoadedDetections& allGroundTruthDets) {
+    // class ids index the per-class tables, so marks and predictions of classes missing from names are left out
+    auto unknownPrediction = [this](const DarkHelp::PredictionResult& p) {
+        return !isKnownClass(p.best_class) || std::any_of(p.all_probabilities.begin(), p.all_probabilities.end(),
+                [this](const auto& classProb) {return !isKnownClass(classProb.first);});
+    };
+    auto unknownMark = [this](const LoadedDetection& d) {return !isKnownClass(d.classId);};
+    DarkHelp::PredictionResults knownPredictions;
+    LoadedDetections knownGroundTruthDets;
+    const DarkHelp::PredictionResults* predictionsPtr = &allPredictions;
+    const LoadedDetections* groundTruthDetsPtr = &allGroundTruthDets;
+    if (std::any_of(allPredictions.begin(), allPredictions.end(), unknownPrediction)) {
+        for (DarkHelp::PredictionResult p: allPredictions) {
+            for (auto it = p.all_probabilities.begin(); it != p.all_probabilities.end(); )
+                it = isKnownClass(it->first) ? std::next(it) : p.all_probabilities.erase(it);
+            if (isKnownClass(p.best_class))
+                knownPredictions.push_back(std::move(p));
+        }
+        predictionsPtr = &knownPredictions;
+    }
+    if (std::any_of(allGroundTruthDets.begin(), allGroundTruthDets.end(), unknownMark)) {
+        std::copy_if(allGroundTruthDets.begin(), allGroundTruthDets.end(), std::back_inserter(knownGroundTruthDets),
+                     [&](const LoadedDetection& d) {return !unknownMark(d);});
+        groundTruthDetsPtr = &knownGroundTruthDets;
+    }
+    const DarkHelp::PredictionResults& predictions = *predictionsPtr;
+    const LoadedDetections& groundTruthDets = *groundTruthDetsPtr;
+    LOG_IF(predictions.size() != allPredictions.size() || groundTruthDets.size() != allGroundTruthDets.size(), WARNING)
+            << "evaluation skips " << (allGroundTruthDets.size() - groundTruthDets.size()) << " marks and "
+            << (allPredictions.size() - predictions.size()) << " predictions with class id out of names range "
+            << "0.." << int(classNames_.size()) - 1;
+
+    BoxesSoA predBoxes, gtBoxes;
+    predBoxes.reserve(predictions.size());
+    gtBoxes.reserve(groundTruthDets.size());
+    for (const auto& prediction: predictions)
+        predBoxes.push_back(relativeBbox(prediction));
+    for (const LoadedDetection& loadedDet: groundTruthDets)
+        gtBoxes.push_back(loadedDet.bbox);
+    const std::vector<BoxMatch> pairs = overlappingPairs(predBoxes, gtBoxes);
+
+    // match at each IoU threshold; detections[t] = {classId, {score, tp}}.
+    // All predictions count here, however low their score: cutting them off would cut the tail of PR curves and AP
+    std::vector<std::vector<std::pair<int, ScoredDetection>>> detections(iouThresholds_.size());
+    std::vector<int> matchedClass(predictions.size());
+    for (size_t t = 0; t < iouThresholds_.size(); ++t) {
+        std::vector<BoxMatch> candidates;
+        for (const BoxMatch& pair: pairs) {
+            if (pair.iou > iouThresholds_[t]) {
+                float p = getProb(predictions[pair.pred], groundTruthDets[pair.gt].classId);
+                if (p > 0)
+                    candidates.push_back({pair.pred, pair.gt, p, pair.iou});
+            }
+        }
+        std::fill(matchedClass.begin(), matchedClass.end(), -1);
+        for (const BoxMatch& m: greedyOneToOneMatch(std::move(candidates), predictions.size(), groundTruthDets.size()))
+            matchedClass[m.pred] = groundTruthDets[m.gt].classId;
+        for (size_t i = 0; i < predictions.size(); ++i)
+            for (const auto& classProb: predictions[i].all_probabilities)
+                detections[t].push_back({classProb.first, {classProb.second, matchedClass[i] == classProb.first}});
+    }
+
+    // confusion: match regardless of class, by the best class probability, at the same operating point as .duv
+    std::vector<BoxMatch> candidates;
+    for (const BoxMatch& pair: pairs) {
+        const auto& prediction = predictions[pair.pred];
+        if (pair.iou > kStrongIntersectionThresh && prediction.best_probability > kValidationProbThresh)
+            candidates.push_back({pair.pred, pair.gt, prediction.best_probability, pair.iou});
+    }
+    std::vector<BoxMatch> matches = greedyOneToOneMatch(std::move(candidates), predictions.size(), groundTruthDets.size());
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++numImages_;
+    for (const LoadedDetection& loadedDet: groundTruthDets) {
+        ensureClass(loadedDet.classId);
+        ++classes_[loadedDet.classId].numMarks;
+    }
+    for (size_t t = 0; t < detections.size(); ++t) {
+        for (const auto& d: detections[t]) {
+            ensureClass(d.first);
+            classes_[d.first].detections[t].push_back(d.second);
+        }
+    }
+    std::vector<char> predMatched(predictions.size(), 0), gtMatched(groundTruthDets.size(), 0);
+    for (const BoxMatch& m: matches) {
+        const int predClass = predictions[m.pred].best_class, gtClass = groundTruthDets[m.gt].classId;
+        ensureClass(std::max(predClass, gtClass));
+        ++confusion_[gtClass][predClass];
+        predMatched[m.pred] = gtMatched[m.gt] = 1;
+    }
+    for (size_t g = 0; g < groundTruthDets.size(); ++g)
+        missed_[groundTruthDets[g].classId] += !gtMatched[g];
+    for (size_t i = 0; i < predictions.size(); ++i) {
+        if (!predMatched[i] && predictions[i].best_probability > kValidationProbThresh) {
+            ensureClass(predictions[i].best_class);
+            ++unmatched_[predictions[i].best_class];
+        }
+    }
+}
+
+size_t DetectionEvaluator::numImages() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return numImages_;
+}
+
+std::vector<DetectionEvaluator::ScoredDetection> DetectionEvaluator::sortedDetections(int classId,
+                                                                                    size_t iouIndex) const {
+    std::vector<ScoredDetection> sorted = classes_[classId].detections[iouIndex];
+    // false positives go first among equal scores, so the result doesn't depend on the order images were added in
+    std::sort(sorted.begin(), sorted.end(), [](const ScoredDetection& l, const ScoredDetection& r) {
+        return (l.score != r.score) ? (l.score > r.score) : (l.tp < r.tp);
+    });
+    return sorted;
+}
+
+float DetectionEvaluator::averagePrecisionLocked(int classId, size_t iouIndex) const {
+    if (classId < 0 || classId >= int(classes_.size()) || 0 == classes_[classId].numMarks)
+        return -1;
+    const ClassStats& stats = classes_[classId];
+    const std::vector<ScoredDetection> detections = sortedDetections(classId, iouIndex);
+
+    std::vector<float> precision, recall;
+    size_t numTp = 0;
+    for (size_t k = 0; k < detections.size(); ++k) {
+        numTp += detections[k].tp;
+        precision.push_back(float(numTp) / (k + 1));
+        recall.push_back(float(numTp) / stats.numMarks);
+    }
+    // area under the precision envelope ("all-point interpolation")
+    for (int k = int(precision.size()) - 2; k >= 0; --k)
+        precision[k] = std::max(precision[k], precision[k + 1]);
+    float ap = 0, prevRecall = 0;
+    for (size_t k = 0; k < precision.size(); ++k) {
+        ap += (recall[k] - prevRecall) * precision[k];
+        prevRecall = recall[k];
+    }
+    return ap;
+}
+
+float DetectionEvaluator::averagePrecision(int classId, size_t iouIndex) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return averagePrecisionLocked(classId, iouIndex);
+}
+
+float DetectionEvaluator::meanAveragePrecisionLocked(size_t iouIndex) const {
+    float sum = 0;
+    int numClasses = 0;
+    for (int c = 0; c < int(classes_.size()); ++c) {
+        float ap = averagePrecisionLocked(c, iouIndex);
+        if (ap >= 0) {
+            sum += ap;
+            ++numClasses;
+        }
+    }
+    return numClasses > 0 ? sum / numClasses : 0;
+}
+
+float DetectionEvaluator::meanAveragePrecision(size_t iouIndex) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return meanAveragePrecisionLocked(iouIndex);
+}
+
+std::string DetectionEvaluator::className(int classId) const {
+    return classId < int(classNames_.size()) ? classNames_[classId] : ("class" + to_string(classId));
+}
+
+std::string DetectionEvaluator::report() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const size_t numIous = iouThresholds_.size();
+    const int numClasses = classes_.size();
+    std::ostringstream ss;
+    ss << std::fixed << std::setprecision(4);
+    ss << "# " << numImages_ << " images, AP over all predictions, confusion matrix of predictions with prob > "
+       << std::setprecision(2) << kValidationProbThresh << std::setprecision(4) << "\n";
+
+    // mean AP
+    float meanOverIous = 0;
+    for (size_t t = 0; t < numIous; ++t) {
+        float map = meanAveragePrecisionLocked(t);
+        meanOverIous += map / numIous;
+        ss << "mAP@" << std::setprecision(2) << iouThresholds_[t] << std::setprecision(4) << "\t" << map << "\n";
+    }
+    if (numIous > 1)
+        ss << "mAP@" << std::setprecision(2) << iouThresholds_.front() << ":" << iouThresholds_.back()
+           << std::setprecision(4) << "\t" << meanOverIous << "\n";
+
+    // AP per class
+    ss << "\n# average precision per class\nclass\tname\tmarks";
+    for (float iou: iouThresholds_)
+        ss << "\tAP@" << std::setprecision(2) << iou;
+    ss << std::setprecision(4) << "\n";
+    for (int c = 0; c < numClasses; ++c) {
+        ss << c << "\t" << className(c) << "\t" << classes_[c].numMarks;
+        for (size_t t = 0; t < numIous; ++t) {
+            float ap = averagePrecisionLocked(c, t);
+            if (ap >= 0)
+                ss << "\t" << ap;
+            else
+                ss << "\t-";
+        }
+        ss << "\n";
+    }
+
+    // precision and recall of predictions with score >= thresh, at the first IoU threshold
+    if (numIous > 0) {
+        ss << "\n# precision-recall curves at IoU " << std::setprecision(2) << iouThresholds_.front()
+           << "\nclass\tname\tscore\tprecision\trecall\n";
+        for (int c = 0; c < numClasses; ++c) {
+            if (0 == classes_[c].numMarks)
+                continue;
+            const std::vector<ScoredDetection> detections = sortedDetections(c, 0);
+            // cumTp[n] = true positives among the first n detections
+            std::vector<size_t> cumTp(detections.size() + 1, 0);
+            for (size_t i = 0; i < detections.size(); ++i)
+                cumTp[i + 1] = cumTp[i] + detections[i].tp;
+            for (int step = 0; step * kPrCurveStep < 1 - kPrCurveStep / 2; ++step) {
+                const float thresh = 1 - step * kPrCurveStep;
+                // detections with score >= thresh go first
+                size_t n = std::partition_point(detections.begin(), detections.end(),
+                        [thresh](const ScoredDetection& d) {return d.score >= thresh;}) - detections.begin();
+                ss << c << "\t" << className(c) << "\t" << std::setprecision(2) << thresh << std::setprecision(4)
+                   << "\t" << (n > 0 ? float(cumTp[n]) / n : 1.f) << "\t" << float(cumTp[n]) / classes_[c].numMarks << "\n";
+            }
+        }
+    }
+
+    // confusion matrix
+    ss << "\n# confusion matrix, prob > " << std::setprecision(2) << kValidationProbThresh
+       << ", IoU > " << kStrongIntersectionThresh
+       << ": rows are marks, columns are predicted classes, 'none' is no match\nmark\\pred";
+    for (int c = 0; c < numClasses; ++c)
+        ss << "\t" << className(c);
+    ss << "\tnone\n";
+    for (int gt = 0; gt < numClasses; ++gt) {
+        ss << className(gt);
+        for (int c = 0; c < numClasses; ++c)
+            ss << "\t" << confusion_[gt][c];
+        ss << "\t" << missed_[gt] << "\n";
+    }
+    ss << "none";
+    for (int c = 0; c < numClasses; ++c)
+        ss << "\t" << unmatched_[c];
+    ss << "\t-\n";
+    return ss.str();
+}
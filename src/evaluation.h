@@ -0,0 +1,67 @@
+#ifndef EVALUATION_H
+#define EVALUATION_H
+
+#include "du_common.h"
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Detection metrics accumulated image by image while the dataset is being validated:
+// per-class average precision at several IoU thresholds, precision-recall curves and class confusion matrix.
+// Predictions are matched with ground truth marks one-to-one, the same way as in comparePredictions.
+// AP and PR curves use every prediction passed in, so the network should keep low-score ones (kRawDumpProbFloor);
+// the confusion matrix only counts predictions with prob > kValidationProbThresh.
+// addImage() may be called from several threads
+class DetectionEvaluator {
+public:
+    // IoU thresholds 0.5, 0.55 .. 0.95
+    static std::vector<float> defaultIouThresholds();
+
+    explicit DetectionEvaluator(std::vector<std::string> classNames,
+                                std::vector<float> iouThresholds = defaultIouThresholds());
+
+    // marks and predictions with class ids out of classNames range are skipped with a warning
+    void addImage(const DarkHelp::PredictionResults& predictions, const LoadedDetections& groundTruthDets);
+
+    size_t numImages() const;
+    // all-point interpolated AP of class classId at iouThresholds[iouIndex], or -1 if there are no marks of this class
+    float averagePrecision(int classId, size_t iouIndex) const;
+    // mean AP over classes that have marks
+    float meanAveragePrecision(size_t iouIndex) const;
+    // text report: AP table, PR curves at the first IoU threshold, confusion matrix
+    std::string report() const;
+
+private:
+    // prediction of one class with its score; tp = it was matched with a mark of this class
+    struct ScoredDetection {
+        float score;
+        bool tp;
+    };
+    // per class and IoU threshold
+    struct ClassStats {
+        size_t numMarks = 0;
+        std::vector<std::vector<ScoredDetection>> detections; // [iouIndex]
+    };
+
+    // 0 <= classId < number of class names
+    bool isKnownClass(int classId) const;
+    void ensureClass(int classId);
+    // by decreasing score
+    std::vector<ScoredDetection> sortedDetections(int classId, size_t iouIndex) const;
+    float averagePrecisionLocked(int classId, size_t iouIndex) const;
+    float meanAveragePrecisionLocked(size_t iouIndex) const;
+    std::string className(int classId) const;
+
+    std::vector<std::string> classNames_;
+    std::vector<float> iouThresholds_;
+    size_t numImages_ = 0;
+    std::vector<ClassStats> classes_;
+    // matched marks and predictions with prob > kValidationProbThresh and iou > kStrongIntersectionThresh:
+    // confusion_[gt class][predicted class]
+    std::vector<std::vector<size_t>> confusion_;
+    std::vector<size_t> missed_; // [gt class]: marks without prediction
+    std::vector<size_t> unmatched_; // [predicted class]: predictions without mark
+    mutable std::mutex mutex_;
+};
+
+#endif // EVALUATION_H
@@ -1,8 +1,11 @@
 #include "cv_funcs.h"
 #include "extract_frames.h"
 #include "helpers.h"
+#include "parallel.h"
 #include <easylogging++.h>
 #include <opencv2/opencv.hpp>
+#include <atomic>
+#include <cctype>
 #include <set>
 #include <vector>
 #include <algorithm>
@@ -10,57 +13,177 @@
 
 using namespace cv;
 
-void extractFrames(const std::string& pathToVids, double fps, float similarityThresh) {
-    constexpr const char* outputDirPath = "extracted_frames/";
-    // get videos
+// seeking is only used when at least this many frames are skipped between saved ones;
+// otherwise decoding them is cheaper than decoding from the keyframe after each seek
+constexpr int kMinFramesToSkipForSeek = 8;
+// calibrateSimilarity compares at most this many pairs of sampled frames in each video
+constexpr int kMaxCalibrationPairsPerVideo = 200;
+// pairs of first sampled frames compared by extractFrames when similarity scale isn't given
+constexpr size_t kAutoCalibrationPairs = 50;
+
+// result of extracting frames from one video
+struct ExtractedVideo {
+    int numFramesSaved = 0;
+    // thumbnails of first and last sampled frames to check similarity between videos after they're all done
+    cv::Mat firstFrameThumb, lastFrameThumb;
+    std::string firstFramePath; // empty if the first frame wasn't saved
+};
+
+static ExtractedVideo extractVideoFrames(const std::string& pathToVids, const std::string& vidFileName,
+                                         const std::string& outputDirPath, double fps, float similarityThresh,
+                                         bool seek, const std::string& progress) {
+    ExtractedVideo result;
+    std::string filePath = pathToVids + "/" + vidFileName;
+    VideoCapture cap(filePath);
+    double captureFps = cap.get(CAP_PROP_FPS);
+    int totalFrames = cap.get(CAP_PROP_FRAME_COUNT);
+    if (!cap.isOpened()) {
+        LOG(ERROR) << "can not open stream: " << filePath;
+        return result;
+    }
+    const int framesToSkip = std::max(0, int(captureFps/fps) - 1);
+    bool seeking = seek && framesToSkip >= kMinFramesToSkipForSeek;
+    LOG(INFO) << progress << " extracting frames from " << vidFileName << " (" << captureFps << " fps, saving every "
+              << (framesToSkip+1) << "th frame" << (seeking ? ", seeking" : "") << ")";
+    const bool checkSimilarity = !almostEqual(0, similarityThresh);
+    cv::Mat prevThumb; // for similarity check
+    for (size_t frameIndex = 0; frameIndex < totalFrames && cap.isOpened(); ++frameIndex) {
+        const int targetFrame = frameIndex * (framesToSkip + 1);
+        cv::Mat m;
+        if (seeking && frameIndex > 0) {
+            if (totalFrames > 0 && targetFrame >= totalFrames)
+                break;
+            cap.set(CAP_PROP_POS_FRAMES, targetFrame);
+            cap >> m;
+            if (nullptr != m.data && int(cap.get(CAP_PROP_POS_FRAMES)) != targetFrame + 1) {
+                // the container doesn't seek precisely: start over and decode frames up to the target one
+                LOG(WARNING) << "seeking in " << vidFileName << " is not precise, decoding all frames instead";
+                seeking = false;
+                cap = VideoCapture(filePath);
+                for (int f = 0; f < targetFrame && cap.grab(); ++f) {}
+                cap >> m;
+            }
+        } else {
+            cap >> m;
+        }
+        if (nullptr == m.data)
+            break;
+        std::string outFramePath = outputDirPath
+                + removeAllChars(vidFileName, '.') + "_fr" + leadingZeros(frameIndex, 4) + ".jpg";
+        bool areSimilar = false;
+        cv::Mat thumb;
+        if (checkSimilarity) {
+            thumb = similarityThumbnail(m);
+            areSimilar = (nullptr != prevThumb.data && prevThumb.size() == thumb.size()
+                         && thumbnailDiff(prevThumb, thumb, similarityThresh) < similarityThresh);
+        }
+        if (!areSimilar) {
+            bool saved = imwrite(outFramePath, m);
+            LOG_IF(!saved, ERROR) << "failed to save image to " << outFramePath;
+            result.numFramesSaved += int(saved);
+            if (saved && frameIndex == 0)
+                result.firstFramePath = outFramePath;
+        }
+        if (checkSimilarity && frameIndex == 0)
+            result.firstFrameThumb = thumb;
+        prevThumb = thumb;
+        for (size_t fs = 0; !seeking && fs < framesToSkip && cap.isOpened(); ++fs) {
+            cap.grab();
+        }
+    }
+    result.lastFrameThumb = prevThumb;
+    LOG(INFO) << "Saved " << result.numFramesSaved << " frames from " << vidFileName;
+    return result;
+}
+
+// video files in pathToVids, by extension
+static std::vector<std::string> listVideoFiles(const std::string& pathToVids) {
     std::vector<std::string> filesList = listFilesInDir(pathToVids);
     static const std::set<std::string> extensions = {"mp4", "avi", "mov", "mpg", "mpeg", "m4v"};
     const int initialFilesCount = filesList.size();
-    filesList.erase(filesList.begin(), std::find_if(filesList.begin(), filesList.end(),
-                        [&](const std::string& s) {return extensions.end() == extensions.find(s);}));
+    filesList.erase(std::remove_if(filesList.begin(), filesList.end(), [&](const std::string& s) {
+                        size_t iod = s.rfind('.');
+                        std::string ext = (std::string::npos == iod) ? "" : s.substr(iod + 1);
+                        std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) {return std::tolower(c);});
+                        return extensions.end() == extensions.find(ext);
+                    }), filesList.end());
     LOG_IF(filesList.size() != initialFilesCount, WARNING) << "skipping " << (initialFilesCount - filesList.size())
                                                      << " non-video files in " << pathToVids << ".";
+    return filesList;
+}
+
+void extractFrames(const std::string& pathToVids, double fps, float similarityThresh,
+                   const ExtractFramesOptions& options) {
+    constexpr const char* outputDirPath = "extracted_frames/";
+    std::vector<std::string> filesList = listVideoFiles(pathToVids);
     bool succeedWithFolder = createFolderIfDoesntExist(outputDirPath);
     LOG_IF(!succeedWithFolder, FATAL) << "failed to create folder " << succeedWithFolder;
-    cv::Mat prevFrame; // for similarity check (similarity is checked between videos, too)
 
-    for (size_t vidNumber = 0; vidNumber < filesList.size(); ++vidNumber) {
-        const std::string& vidFileName = filesList[vidNumber];
-        std::string filePath = pathToVids + "/" + vidFileName;
+    // similarityThresh is given in imgDiff units; thumbnailDiff values are smaller, see calibrateSimilarity
+    float similarityScale = options.similarityScale;
+    if (similarityScale <= 0 && !almostEqual(0, similarityThresh))
+        similarityScale = calibrateSimilarity(pathToVids, fps, kAutoCalibrationPairs);
+    const float thumbThresh = similarityThresh * similarityScale;
+    std::vector<ExtractedVideo> videos(filesList.size());
+    std::atomic<size_t> numVideosStarted{0};
+    parallelFor(filesList.size(), std::max(1u, options.numThreads), 1, [&](size_t begin, size_t end) {
+        for (size_t vidNumber = begin; vidNumber < end; ++vidNumber) {
+            std::string progress = std::to_string(++numVideosStarted) + "/" + std::to_string(filesList.size());
+            videos[vidNumber] = extractVideoFrames(pathToVids, filesList[vidNumber], outputDirPath, fps,
+                                                   thumbThresh, options.seek, progress);
+        }
+    });
+
+    // similarity is checked between videos, too: first frame of a video vs the last sampled frame of the previous one
+    int numFramesSaved = 0;
+    const cv::Mat* prevLastFrame = nullptr;
+    for (ExtractedVideo& video: videos) {
+        if (!video.firstFramePath.empty() && nullptr != prevLastFrame) {
+            const cv::Mat& firstFrame = video.firstFrameThumb;
+            if (nullptr != firstFrame.data && prevLastFrame->size() == firstFrame.size()
+                    && thumbnailDiff(*prevLastFrame, firstFrame, thumbThresh) < thumbThresh) {
+                remove(video.firstFramePath.c_str());
+                --video.numFramesSaved;
+            }
+        }
+        numFramesSaved += video.numFramesSaved;
+        if (nullptr != video.lastFrameThumb.data)
+            prevLastFrame = &video.lastFrameThumb;
+    }
+    LOG(INFO) << "Finished. " << numFramesSaved << " frames saved to " << outputDirPath;
+}
+
+double calibrateSimilarity(const std::string& pathToVids, double fps, size_t maxPairs) {
+    double sumFullByThumb = 0, sumFullSquared = 0;
+    size_t numPairs = 0;
+    for (const std::string& vidFileName: listVideoFiles(pathToVids)) {
+        if (numPairs >= maxPairs)
+            break;
+        const std::string filePath = pathToVids + "/" + vidFileName;
         VideoCapture cap(filePath);
-        double captureFps = cap.get(CAP_PROP_FPS);
-        int totalFrames = cap.get(CAP_PROP_FRAME_COUNT);
         if (!cap.isOpened()) {
             LOG(ERROR) << "can not open stream: " << filePath;
             continue;
         }
-        const int framesToSkip = int(captureFps/fps) - 1;
-        LOG(INFO) << (vidNumber+1) << "/" << filesList.size() << " extracting frames from "
-                  << vidFileName << " (" << captureFps << " fps, saving every " << (framesToSkip+1) << "th frame)";
-        int numFramesSaved = 0;
-        for (size_t frameIndex = 0; frameIndex < totalFrames && cap.isOpened(); ++frameIndex) {
-            cv::Mat m;
-            cap >> m;
-            if (nullptr == m.data)
-                break;
-            std::string outFramePath = std::string(outputDirPath)
-                    + removeAllChars(vidFileName, '.') + "_fr" + leadingZeros(frameIndex, 4) + ".jpg";
-            bool areSimilar = false;
-            if (!almostEqual(0, similarityThresh)) {
-                areSimilar = (prevFrame.size() == m.size()
-                             && imgDiff(prevFrame, m) < similarityThresh);
-            }
-            if (!areSimilar) {
-                bool saved = imwrite(outFramePath, m);
-                LOG_IF(!saved, ERROR) << "failed to save image to " << outFramePath;
-                numFramesSaved += int(saved);
-            }
-            prevFrame = m;
-            for (size_t fs = 0; fs < framesToSkip && cap.isOpened(); ++fs) {
-                cap.grab();
+        const int framesToSkip = std::max(0, int(cap.get(CAP_PROP_FPS) / fps) - 1);
+        cv::Mat prevFrame, prevThumb, m;
+        for (int n = 0; n < kMaxCalibrationPairsPerVideo && numPairs < maxPairs && cap.read(m); ++n) {
+            cv::Mat thumb = similarityThumbnail(m);
+            if (nullptr != prevFrame.data && prevFrame.size() == m.size()) {
+                const double full = imgDiff(prevFrame, m), small = thumbnailDiff(prevThumb, thumb);
+                sumFullByThumb += full * small;
+                sumFullSquared += full * full;
+                ++numPairs;
             }
+            prevFrame = m.clone();
+            prevThumb = thumb;
+            for (int fs = 0; fs < framesToSkip && cap.grab(); ++fs) {}
         }
-        LOG(INFO) << "Saved " << numFramesSaved << " frames from " << vidFileName;
     }
-    LOG(INFO) << "Finished. Frames saved to " << outputDirPath;
+    // least squares fit of thumbnailDiff = scale * imgDiff
+    LOG_IF(sumFullSquared <= 0, WARNING) << "no differing frames found in " << pathToVids << ", keeping scale 1";
+    const double scale = (sumFullSquared > 0) ? sumFullByThumb / sumFullSquared : 1;
+    LOG(INFO) << "compared " << numPairs << " pairs of frames, similarity scale = " << scale
+              << ". Pass --simscale " << scale << " to extractframes to keep similarity thresholds tuned for imgDiff";
+    return scale;
 }
@@ -1,11 +1,29 @@
 #ifndef EXTRACT_FRAMES_H
 #define EXTRACT_FRAMES_H
 
+#include <cstdint>
 #include <string>
 
+struct ExtractFramesOptions {
+    // jump straight to each frame to save instead of decoding all frames in between. Pays off when only few frames
+    // are kept (e.g. 1 fps out of 60 fps); falls back to decoding all frames if the video can't seek precisely
+    bool seek = false;
+    // number of videos processed at the same time
+    unsigned numThreads = 1;
+    // frames are compared by thumbnailDiff, which is about similarityScale * imgDiff; similarityThresh is
+    // multiplied by it. 0 = measure it with calibrateSimilarity on the first sampled frames
+    float similarityScale = 0;
+};
+
 // for each video in pathWithVids, open and extract frames to output folder
 // similarityThresh: if >0, consecutive frames will be checked for similarity and too similar frames will not be saved
 // Recommended value for similarityThresh = 0.002
-void extractFrames(const std::string& pathToVids, double fps, float similarityThresh = 0);
+void extractFrames(const std::string& pathToVids, double fps, float similarityThresh = 0,
+                   const ExtractFramesOptions& options = ExtractFramesOptions());
+
+// compares consecutive frames sampled at fps with both imgDiff and thumbnailDiff and returns scale that fits
+// thumbnailDiff = scale * imgDiff best (least squares). Use it as ExtractFramesOptions::similarityScale.
+// Stops after maxPairs pairs of frames
+double calibrateSimilarity(const std::string& pathToVids, double fps, size_t maxPairs = SIZE_MAX);
 
 #endif // EXTRACT_FRAMES_H
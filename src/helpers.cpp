@@ -1,4 +1,5 @@
 #include "helpers.h"
+#include "dataset_enum.h"
 
 // for absolute path
 #include <sstream>
@@ -9,7 +10,8 @@
 #include <unistd.h>         // readlink
 #include <linux/limits.h>   // PATH_MAX
 #include <unistd.h>         // readlink
-#include <dirent.h>         // struct dirent
+#include <fcntl.h>          // open
+#include <sys/mman.h>       // mmap
 #include <chrono>
 
 using std::string;
@@ -61,6 +63,19 @@ bool saveToFile(const std::string& path, const std::string& content, bool append
     return true;
 }
 
+bool saveToFileAtomic(const std::string& path, const std::string& content) {
+    const std::string tmpPath = path + ".tmp";
+    {
+        std::ofstream outfile(tmpPath, std::ios_base::out | std::ios_base::trunc);
+        if (!outfile.is_open())
+            return false;
+        outfile << content;
+        if (!outfile.good())
+            return false;
+    }
+    return 0 == rename(tmpPath.c_str(), path.c_str());
+}
+
 std::string getFileContents(const std::string& filename) {
     std::ifstream file(filename.c_str());
     if (!file.is_open()) {
@@ -84,21 +99,7 @@ std::string vectorToString(const std::vector<T>& v) {
 
 std::vector<std::string> listFilesInDir(const std::string& dirPath) {
     std::vector<std::string> result;
-    DIR *d;
-    struct dirent *dir;
-    d = opendir(dirPath.c_str());
-    if (!d) {
-        LOG(ERROR) << "failed to list files in dir " << dirPath;
-        return result;
-    }
-
-    while ((dir = readdir(d)) != NULL) {
-        std::string filename = std::string(dir->d_name);
-        if (filename != "." && filename != "..") {
-            result.push_back(filename);
-        }
-    }
-    closedir(d);
+    forEachDirEntry(dirPath, [&](std::string_view name, bool) {result.emplace_back(name);});
     return result;
 }
 
@@ -122,6 +123,61 @@ bool ifFileExists(const std::string& path) {
     return (stat (path.c_str(), &sb) == 0);
 }
 
+bool getFileSizeAndMtime(const std::string& path, uint64_t& size, int64_t& mtimeNs) {
+    struct stat sb;
+    if (stat(path.c_str(), &sb) != 0)
+        return false;
+    size = sb.st_size;
+    mtimeNs = int64_t(sb.st_mtim.tv_sec) * 1000000000 + sb.st_mtim.tv_nsec;
+    return true;
+}
+
+uint64_t fnv1aHash(const void* data, size_t size, uint64_t seed) {
+    constexpr uint64_t kFnvPrime = 1099511628211ull;
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    uint64_t hash = seed;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= kFnvPrime;
+    }
+    return hash;
+}
+
+uint64_t fileContentsHash(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        LOG(ERROR) << "fileContentsHash: can\'t open file " << path;
+        return 0;
+    }
+    std::vector<char> buffer(1 << 20);
+    uint64_t hash = kFnvOffsetBasis;
+    while (file) {
+        file.read(buffer.data(), buffer.size());
+        hash = fnv1aHash(buffer.data(), file.gcount(), hash);
+    }
+    return hash;
+}
+
+MappedFile::MappedFile(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+    struct stat sb;
+    if (fstat(fd, &sb) == 0 && sb.st_size > 0) {
+        void* addr = mmap(nullptr, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (MAP_FAILED != addr) {
+            data_ = static_cast<const char*>(addr);
+            size_ = sb.st_size;
+        }
+    }
+    close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (nullptr != data_)
+        munmap(const_cast<char*>(data_), size_);
+}
+
 bool createFolderIfDoesntExist(const std::string& path) {
     if (!ifFolderExists(path)) {
         if (mkdir(path.c_str(), 0777) == -1) {
@@ -5,6 +5,7 @@
 #include <string>
 #include <vector>
 #include <cmath>
+#include <cstdint>
 
 // returns file contents as string
 std::string getFileContents(const std::string& filename);
@@ -32,6 +33,10 @@ inline std::string addSlash(const std::string& path) {return (!path.empty() && p
 // write text to file. Returns true if successful
 bool saveToFile(const std::string& path, const std::string& content, bool append = false);
 
+// write text to temporary file next to path and rename it to path, so that path never has partial contents.
+// Returns true if successful
+bool saveToFileAtomic(const std::string& path, const std::string& content);
+
 // ls command
 std::vector<std::string> listFilesInDir(const std::string& dirPath);
 
@@ -52,6 +57,33 @@ std::vector<T> stringToArray(const std::string& str) {
 // split string s by character c
 std::vector<std::string> splitString(const std::string s, char c);
 
+// get file size in bytes and last modification time in nanoseconds. Returns false if file can't be accessed
+bool getFileSizeAndMtime(const std::string& path, uint64_t& size, int64_t& mtimeNs);
+
+// 64-bit FNV-1a hash of data; pass the previous result as seed to hash data by parts
+constexpr uint64_t kFnvOffsetBasis = 14695981039346656037ull;
+uint64_t fnv1aHash(const void* data, size_t size, uint64_t seed = kFnvOffsetBasis);
+
+// FNV-1a hash of the file contents, or 0 if file can't be read
+uint64_t fileContentsHash(const std::string& path);
+
+// read-only memory mapping of a whole file
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool isOpen() const {return nullptr != data_;}
+    const char* data() const {return data_;}
+    size_t size() const {return size_;}
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+};
+
 // returns true if folder with this path exists
 bool ifFolderExists(const std::string& path);
 
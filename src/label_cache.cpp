@@ -0,0 +1,98 @@
+#include "label_cache.h"
+#include "helpers.h"
+#include "easylogging++.h"
+#include <vector>
+
+LabelCache::LabelCache(std::chrono::milliseconds flushInterval)
+    : flushInterval_(flushInterval), thread_(&LabelCache::run, this) {}
+
+LabelCache::~LabelCache() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    stopRequested_.notify_all();
+    thread_.join();
+    flush();
+}
+
+LoadedDetections LabelCache::get(const std::string& pathToTxt) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.find(pathToTxt);
+        if (entries_.end() != it)
+            return it->second.dets;
+    }
+    Entry entry;
+    entry.dets = loadedDetectionsFromFile(pathToTxt);
+    entry.originalContents = to_string(entry.dets);
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.emplace(pathToTxt, std::move(entry)).first->second.dets;
+}
+
+void LabelCache::set(const std::string& pathToTxt, LoadedDetections dets, const std::string& pathToBackup) {
+    get(pathToTxt); // make sure original contents are known
+    std::lock_guard<std::mutex> lock(mutex_);
+    Entry& entry = entries_[pathToTxt];
+    entry.dets = std::move(dets);
+    if (entry.pathToBackup.empty())
+        entry.pathToBackup = pathToBackup;
+    ++entry.version;
+}
+
+void LabelCache::flush() {
+    struct PendingWrite {
+        std::string path;
+        std::string contents;
+        std::string pathToBackup, backupContents; // empty if no backup needed
+        uint64_t version;
+    };
+    std::lock_guard<std::mutex> flushLock(flushMutex_);
+    // take a snapshot of changed files, then write them without blocking get() and set()
+    std::vector<PendingWrite> writes;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& e: entries_) {
+            Entry& entry = e.second;
+            if (entry.version == entry.savedVersion)
+                continue;
+            PendingWrite w{e.first, to_string(entry.dets), "", "", entry.version};
+            if (!entry.backupDone && !entry.pathToBackup.empty()) {
+                w.pathToBackup = entry.pathToBackup;
+                w.backupContents = entry.originalContents;
+            }
+            writes.push_back(std::move(w));
+        }
+    }
+
+    for (const auto& w: writes) {
+        bool backupOk = true;
+        if (!w.pathToBackup.empty()) {
+            if (!ifFileExists(w.pathToBackup))
+                backupOk = saveToFile(w.pathToBackup, w.backupContents);
+            else
+                LOG(INFO) << "backup " << w.pathToBackup << " already exists, dont overwrite.";
+            LOG_IF(!backupOk, ERROR) << "failed to save backup " << w.pathToBackup;
+        }
+        bool saved = saveToFileAtomic(w.path, w.contents);
+        LOG_IF(!saved, ERROR) << "failed to save labels to " << w.path << ", will retry";
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        Entry& entry = entries_[w.path];
+        entry.backupDone = entry.backupDone || (backupOk && !w.pathToBackup.empty());
+        if (saved)
+            entry.savedVersion = std::max(entry.savedVersion, w.version);
+    }
+}
+
+void LabelCache::run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stop_) {
+        stopRequested_.wait_for(lock, flushInterval_, [this] {return stop_;});
+        if (stop_)
+            return;
+        lock.unlock();
+        flush();
+        lock.lock();
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef LABEL_CACHE_H
+#define LABEL_CACHE_H
+
+#include "du_common.h"
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+// In-memory copy of label .txt files edited by cure. Each file is read from disk once; changes are written back
+// by a background thread every flushInterval and on destruction, so edits never wait for disk.
+// Files are replaced atomically, and before the first change of a file its original contents are saved
+// to backup path (unless backup already exists).
+class LabelCache {
+public:
+    explicit LabelCache(std::chrono::milliseconds flushInterval = std::chrono::seconds(2));
+    // writes all pending changes
+    ~LabelCache();
+    LabelCache(const LabelCache&) = delete;
+    LabelCache& operator=(const LabelCache&) = delete;
+
+    // labels from .txt file, or from the cache if the file has been read before
+    LoadedDetections get(const std::string& pathToTxt);
+    // replace labels; the file will be written in the background.
+    // pathToBackup: where to save original contents of the file; empty = no backup
+    void set(const std::string& pathToTxt, LoadedDetections dets, const std::string& pathToBackup);
+    // write all pending changes now
+    void flush();
+
+private:
+    struct Entry {
+        LoadedDetections dets;
+        std::string originalContents; // as it was on disk, for backup
+        std::string pathToBackup;
+        bool backupDone = false;
+        uint64_t version = 0; // incremented on every change
+        uint64_t savedVersion = 0;
+    };
+
+    void run();
+
+    std::unordered_map<std::string, Entry> entries_;
+    const std::chrono::milliseconds flushInterval_;
+    bool stop_ = false;
+    std::mutex mutex_; // guards entries_ and stop_
+    std::mutex flushMutex_; // one flush at a time
+    std::condition_variable stopRequested_;
+    std::thread thread_;
+};
+
+#endif // LABEL_CACHE_H
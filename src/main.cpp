@@ -2,6 +2,9 @@
 #include <iostream>
 #include <string>
 #include <map>
+#include <set>
+#include <sstream>
+#include <type_traits>
 
 // 3rd-party
 #include <easylogging++.h>
@@ -17,6 +20,12 @@
 #include "cv_funcs.h"
 #include "extract_frames.h"
 #include "du_utilities.h"
+#include "duv_io.h"
+#include "prediction_store.h"
+#include "rethreshold.h"
+#include "dedup.h"
+#include "sanity_check.h"
+#include "detector.h"
 
 INITIALIZE_EASYLOGGINGPP
 
@@ -28,15 +37,96 @@ using std::endl;
 static int showUsage(std::string name) {
     cerr << "Usage: " << endl
            //        0          1        2           3           4          5           6
-         << "\t" << name << " markvid yoloCfgFile weightsFile namesFile inputVideo" << endl
-         << "\t" << name << " markimgs yoloCfgFile weightsFile namesFile /path/to/imgs/" << endl
-         << "\t" << name << " extractframes /path/to/videos/ fps similarityThresh=0" << endl
+         << "\t" << name << " markvid yoloCfgFile weightsFile namesFile inputVideo [--keyframe N] [--motion 0..1]"
+                        " [--batch N] [--backend darkhelp|mock]" << endl
+         << "\t" << name << " markimgs yoloCfgFile weightsFile namesFile /path/to/imgs/ [--workers N]"
+                        " [--batch N] [--backend darkhelp|mock]" << endl
+         << "\t" << name << " extractframes /path/to/videos/ fps similarityThresh=0 [--seek] [--threads N]"
+                        " [--simscale S]" << endl
+         << "\t" << name << " calibratesimilarity /path/to/videos/ fps" << endl
          << "\t" << name << " addemptytxt /path/to/dataset/" << endl
+         << "\t" << name << " sanitycheck /path/to/dataset/ report.txt [--decode] [--threads N]" << endl
+         << "\t" << name << " dedup /path/to/train.txt|/path/to/imgs/ report.txt [--distance 0..64] [--remove]"
+                        " [--threads N]" << endl
          << "\t" << name << " test /path/to/darkutils/data/tests/"  << endl
-         << "\t" << name << " validate yoloCfgFile weightsFile namesFile /path/to/train.txt outputFile.duv.tsv"  << endl
-         << "\t" << name << " cure /path/to/results.duv.tsv namesFile" << endl;
+         << "\t" << name << " validate yoloCfgFile weightsFile namesFile /path/to/train.txt outputFile.duv.tsv"
+                        " [--workers N] [--cache path/to/cache | --nocache] [--rawdump path/to/raw.preds]"
+                        " [--batch N] [--backend darkhelp|mock]" << endl
+         << "\t" << name << " evaluate yoloCfgFile weightsFile namesFile /path/to/train.txt outputFile.duv.tsv report.txt"
+                        " [--workers N] [--cache path/to/cache | --nocache] [--rawdump path/to/raw.preds]"
+                        " [--batch N] [--backend darkhelp|mock]" << endl
+         << "\t" << name << " rethreshold raw.preds outputFile.duv.tsv probThresh iouThresh" << endl
+         << "\t" << name << " sweep raw.preds report.tsv" << endl
+         << "\t" << name << " cure /path/to/results.duv.tsv namesFile [--prob P] [--iou I]" << endl
+         << "\t" << name << " convert input.duv.tsv output.duvb [--cfg yoloCfgFile --weights weightsFile]" << endl
+         << "\t" << name << " convert input.duvb output.duv.tsv" << endl
+         << "--batch N groups up to N images per predictBatch call; the darkhelp backend still runs them through"
+            " the network one at a time, as DarkHelp has no batched predict" << endl;
     return -1;
 }
+
+// removes trailing "--name value" options (or "--name" flags) from argv and returns them; argc is updated.
+// Options go after positional arguments
+static std::map<std::string, std::string> extractOptions(int& argc, char **argv) {
+    std::map<std::string, std::string> options;
+    int firstOption = argc;
+    for (int i = 1; i < argc && firstOption == argc; ++i)
+        if (std::string(argv[i]).rfind("--", 0) == 0)
+            firstOption = i;
+    for (int i = firstOption; i < argc; ++i) {
+        std::string name = std::string(argv[i]).substr(2);
+        bool hasValue = (i + 1 < argc && std::string(argv[i+1]).rfind("--", 0) != 0);
+        options[name] = hasValue ? argv[++i] : "";
+    }
+    argc = firstOption;
+    return options;
+}
+
+// whole text must be a number; negative values are refused for unsigned types. value is kept on failure
+template<class T>
+static bool parseNumber(const std::string& text, T& value) {
+    if (std::is_unsigned<T>::value && std::string::npos != text.find('-'))
+        return false;
+    std::istringstream ss(text);
+    T parsed;
+    if (!(ss >> parsed) || !(ss >> std::ws).eof())
+        return false;
+    value = parsed;
+    return true;
+}
+
+// positional argument argv[index] as number; prints error if it's not a number
+template<class T>
+static bool numberArg(char **argv, int index, T& value) {
+    if (parseNumber(argv[index], value))
+        return true;
+    cerr << "Invalid number " << argv[index] << endl;
+    return false;
+}
+
+// value of --name option as number, value isn't changed if the option is absent. Prints error if it's not a number
+template<class T>
+static bool numberOption(const std::map<std::string, std::string>& options, const std::string& name, T& value) {
+    auto it = options.find(name);
+    if (options.end() == it || parseNumber(it->second, value))
+        return true;
+    cerr << "Invalid value of --" << name << ": " << it->second << endl;
+    return false;
+}
+
+// --batch and --backend options of commands running inference; returns false for unknown backend or invalid number
+static bool parseDetectorOptions(const std::map<std::string, std::string>& options, DetectorOptions& detectorOptions) {
+    if (!numberOption(options, "batch", detectorOptions.batchSize))
+        return false;
+    if (options.count("backend") && !detectorBackendFromString(options.at("backend"), detectorOptions.backend)) {
+        cerr << "Unknown backend " << options.at("backend") << endl;
+        return false;
+    }
+    LOG_IF(detectorOptions.batchSize > 1 && DetectorBackend::kDarkHelp == detectorOptions.backend, WARNING)
+            << "DarkHelp has no batched predict: images of a batch go through the network one at a time";
+    return true;
+}
+
 int main(int argc, char **argv) {
     el::Loggers::reconfigureAllLoggers(el::ConfigurationType::Format, "%level %msg");
     el::Loggers::addFlag(el::LoggingFlag::ColoredTerminalOutput);
@@ -45,6 +135,7 @@ int main(int argc, char **argv) {
         return showUsage(argv[0]);
 
     std::string command(argv[1]);
+    const std::map<std::string, std::string> options = extractOptions(argc, argv);
 
     // check number of args
     std::map<std::string, int> commandNumArgs = {
@@ -52,21 +143,56 @@ int main(int argc, char **argv) {
         {"markvid", 6},
         {"markimgs", 6},
         {"addemptytxt", 3},
+        {"dedup", 4},
         {"extractframes", 5},
+        {"calibratesimilarity", 4},
         {"validate", 7},
+        {"evaluate", 8},
+        {"rethreshold", 6},
+        {"sweep", 4},
         {"cure", 4},
-        // TODO introduce "sanitycheck" command: checks that each img has .txt, no extra files, no broken images
+        {"convert", 4},
+        {"sanitycheck", 4},
     };
     if (commandNumArgs.end() == commandNumArgs.find(command) || argc != commandNumArgs.at(command))
         return showUsage(argv[0]);
 
+    // options accepted by commands
+    static const std::map<std::string, std::set<std::string>> commandOptions = {
+        {"markvid", {"keyframe", "motion", "batch", "backend"}},
+        {"markimgs", {"workers", "batch", "backend"}},
+        {"dedup", {"distance", "remove", "threads"}},
+        {"sanitycheck", {"decode", "threads"}},
+        {"extractframes", {"seek", "threads", "simscale"}},
+        {"validate", {"workers", "cache", "nocache", "rawdump", "batch", "backend"}},
+        {"evaluate", {"workers", "cache", "nocache", "rawdump", "batch", "backend"}},
+        {"convert", {"cfg", "weights"}},
+        {"cure", {"prob", "iou"}},
+    };
+    for (const auto& o: options) {
+        auto it = commandOptions.find(command);
+        if (commandOptions.end() == it || it->second.end() == it->second.find(o.first)) {
+            cerr << "Unknown option --" << o.first << " for command " << command << endl;
+            return showUsage(argv[0]);
+        }
+    }
+
     if (command == "markvid") {
-        markVid(argv[2], argv[3], argv[4], argv[5]);
+        MarkVidOptions markVidOptions;
+        if (!numberOption(options, "keyframe", markVidOptions.keyframeInterval)
+                || !numberOption(options, "motion", markVidOptions.motionThresh)
+                || !parseDetectorOptions(options, markVidOptions.detector))
+            return showUsage(argv[0]);
+        markVid(argv[2], argv[3], argv[4], argv[5], markVidOptions);
         return 0;
     }
 
     if (command == "markimgs") {
-        markImgs(argv[2], argv[3], argv[4], argv[5]);
+        MarkImgsOptions markImgsOptions;
+        if (!numberOption(options, "workers", markImgsOptions.numWorkers)
+                || !parseDetectorOptions(options, markImgsOptions.detector))
+            return showUsage(argv[0]);
+        markImgs(argv[2], argv[3], argv[4], argv[5], markImgsOptions);
         return 0;
     }
 
@@ -74,26 +200,90 @@ int main(int argc, char **argv) {
         return createEmptyTxtFiles(argv[2]);
     }
 
+    if (command == "sanitycheck") {
+        SanityCheckOptions sanityOptions;
+        sanityOptions.decode = (options.count("decode") > 0);
+        if (!numberOption(options, "threads", sanityOptions.numThreads))
+            return showUsage(argv[0]);
+        return sanityCheck(argv[2], argv[3], sanityOptions);
+    }
+
+    if (command == "dedup") {
+        int maxDistance = kDefaultDuplicateDistance;
+        unsigned numThreads = 0;
+        if (!numberOption(options, "distance", maxDistance) || !numberOption(options, "threads", numThreads))
+            return showUsage(argv[0]);
+        return dedupImages(argv[2], argv[3], maxDistance, options.count("remove") > 0, numThreads);
+    }
+
     if (command == "extractframes") {
-        double fps = std::stod(argv[3]);
-        float similarityThresh = std::stof(argv[4]);
-        extractFrames(argv[2], fps, similarityThresh);
+        double fps = 0;
+        float similarityThresh = 0;
+        ExtractFramesOptions extractFramesOptions;
+        extractFramesOptions.seek = (options.count("seek") > 0);
+        if (!numberArg(argv, 3, fps) || !numberArg(argv, 4, similarityThresh)
+                || !numberOption(options, "threads", extractFramesOptions.numThreads)
+                || !numberOption(options, "simscale", extractFramesOptions.similarityScale))
+            return showUsage(argv[0]);
+        extractFrames(argv[2], fps, similarityThresh, extractFramesOptions);
+        return 0;
+    }
+
+    if (command == "calibratesimilarity") {
+        double fps = 0;
+        if (!numberArg(argv, 3, fps))
+            return showUsage(argv[0]);
+        calibrateSimilarity(argv[2], fps);
         return 0;
     }
 
     if (command == "test")
         return runAllTests(argv[2]);
 
-    if (command == "validate") {
-        validateDataset(argv[5], argv[2], argv[3], argv[4], argv[6]);
+    // evaluate = validate + metrics report
+    if (command == "validate" || command == "evaluate") {
+        ValidationOptions validationOptions;
+        if (!numberOption(options, "workers", validationOptions.numWorkers))
+            return showUsage(argv[0]);
+        if (options.count("cache"))
+            validationOptions.cachePath = options.at("cache");
+        validationOptions.useCache = (0 == options.count("nocache"));
+        if (options.count("rawdump"))
+            validationOptions.rawDumpPath = options.at("rawdump");
+        if (command == "evaluate")
+            validationOptions.reportPath = argv[7];
+        if (!parseDetectorOptions(options, validationOptions.detector))
+            return showUsage(argv[0]);
+        validateDataset(argv[5], argv[2], argv[3], argv[4], argv[6], validationOptions);
         return 0;
     }
 
+    if (command == "rethreshold") {
+        ValidationThresholds thresholds;
+        if (!numberArg(argv, 4, thresholds.prob) || !numberArg(argv, 5, thresholds.iou))
+            return showUsage(argv[0]);
+        return rethresholdDuv(argv[2], argv[3], thresholds);
+    }
+
+    if (command == "sweep")
+        return sweepThresholds(argv[2], argv[3]);
+
     if (command == "cure") {
-        cureDataset(argv[2], argv[3]);
+        // .duvb knows thresholds it was made with; for .duv.tsv made by rethreshold they have to be given
+        ValidationThresholds thresholds = duvThresholds(argv[2]);
+        if (!numberOption(options, "prob", thresholds.prob) || !numberOption(options, "iou", thresholds.iou))
+            return showUsage(argv[0]);
+        cureDataset(argv[2], argv[3], thresholds);
         return 0;
     }
 
+    if (command == "convert") {
+        DuvBinaryInfo info;
+        if (options.count("cfg") && options.count("weights"))
+            info.modelFingerprint = modelFingerprint(options.at("cfg"), options.at("weights"));
+        return convertDuv(argv[2], argv[3], info);
+    }
+
     return -1;
 }
 
@@ -0,0 +1,36 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+
+// number of threads to use when numThreads == 0 is requested
+inline unsigned defaultNumThreads() {
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Call func(begin, end) for consecutive chunks of [0, count) from numThreads threads (0 = all cores).
+// Chunks are handed out dynamically, so threads that got cheap chunks take more of them.
+// Returns when all chunks are processed
+inline void parallelFor(size_t count, unsigned numThreads, size_t chunkSize,
+                        const std::function<void(size_t begin, size_t end)>& func) {
+    numThreads = (numThreads == 0) ? defaultNumThreads() : numThreads;
+    chunkSize = std::max<size_t>(1, chunkSize);
+    std::atomic<size_t> nextChunk{0};
+    auto worker = [&] {
+        for (size_t begin = nextChunk.fetch_add(chunkSize); begin < count; begin = nextChunk.fetch_add(chunkSize))
+            func(begin, std::min(count, begin + chunkSize));
+    };
+    const size_t numChunks = (count + chunkSize - 1) / chunkSize;
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < std::min<size_t>(numThreads, numChunks); ++t)
+        threads.emplace_back(worker);
+    worker();
+    for (auto& t: threads)
+        t.join();
+}
+
+#endif // PARALLEL_H
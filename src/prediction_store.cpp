@@ -0,0 +1,200 @@
+#include "prediction_store.h"
+#include "helpers.h"
+#include "easylogging++.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+// "darkutils predictions"
+static const char kStoreMagic[4] = {'D', 'U', 'P', 'S'};
+constexpr uint32_t kStoreVersion = 1;
+
+// little helpers for plain binary (de)serialization in host byte order
+template<class T>
+static void writeRaw(std::ostream& os, const T& value) {
+    os.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template<class T>
+static bool readRaw(std::istream& is, T& value) {
+    return bool(is.read(reinterpret_cast<char*>(&value), sizeof(T)));
+}
+
+static void writePrediction(std::ostream& os, const DarkHelp::PredictionResult& p) {
+    writeRaw<float>(os, p.original_point.x);
+    writeRaw<float>(os, p.original_point.y);
+    writeRaw<float>(os, p.original_size.width);
+    writeRaw<float>(os, p.original_size.height);
+    writeRaw<int32_t>(os, p.rect.x);
+    writeRaw<int32_t>(os, p.rect.y);
+    writeRaw<int32_t>(os, p.rect.width);
+    writeRaw<int32_t>(os, p.rect.height);
+    writeRaw<int32_t>(os, p.best_class);
+    writeRaw<float>(os, p.best_probability);
+    writeRaw<uint32_t>(os, p.all_probabilities.size());
+    for (const auto& classProb: p.all_probabilities) {
+        writeRaw<int32_t>(os, classProb.first);
+        writeRaw<float>(os, classProb.second);
+    }
+}
+
+static bool readPrediction(std::istream& is, DarkHelp::PredictionResult& p) {
+    float x, y, w, h;
+    int32_t rx, ry, rw, rh, bestClass;
+    uint32_t numProbs;
+    if (!readRaw(is, x) || !readRaw(is, y) || !readRaw(is, w) || !readRaw(is, h)
+            || !readRaw(is, rx) || !readRaw(is, ry) || !readRaw(is, rw) || !readRaw(is, rh)
+            || !readRaw(is, bestClass) || !readRaw(is, p.best_probability) || !readRaw(is, numProbs))
+        return false;
+    p.original_point = cv::Point2f(x, y);
+    p.original_size = cv::Size2f(w, h);
+    p.rect = cv::Rect(rx, ry, rw, rh);
+    p.best_class = bestClass;
+    p.all_probabilities.clear();
+    for (uint32_t i = 0; i < numProbs; ++i) {
+        int32_t classId;
+        float prob;
+        if (!readRaw(is, classId) || !readRaw(is, prob))
+            return false;
+        p.all_probabilities[classId] = prob;
+    }
+    return true;
+}
+
+PredictionStore::PredictionStore(uint64_t modelFingerprint, float probFloor)
+    : modelFingerprint_(modelFingerprint), probFloor_(probFloor) {}
+
+bool PredictionStore::load(const std::string& path) {
+    return loadFile(path, false);
+}
+
+bool PredictionStore::loadAny(const std::string& path) {
+    return loadFile(path, true);
+}
+
+bool PredictionStore::loadFile(const std::string& path, bool anyModel) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open())
+        return false;
+    char magic[4];
+    uint32_t version;
+    uint64_t fingerprint, numEntries;
+    float floor;
+    if (!readRaw(file, magic) || 0 != memcmp(magic, kStoreMagic, sizeof(magic))
+            || !readRaw(file, version) || version != kStoreVersion
+            || !readRaw(file, fingerprint) || !readRaw(file, floor) || !readRaw(file, numEntries)) {
+        LOG(WARNING) << path << " is not a predictions file of the supported version, ignoring it";
+        return false;
+    }
+    if (!anyModel && (fingerprint != modelFingerprint_ || floor > probFloor_)) {
+        LOG(INFO) << "predictions in " << path << " were made by another model or threshold, ignoring them";
+        return false;
+    }
+
+    std::unordered_map<std::string, StoredPredictions> entries;
+    entries.reserve(numEntries);
+    for (uint64_t i = 0; i < numEntries; ++i) {
+        uint32_t pathLength, numPredictions;
+        if (!readRaw(file, pathLength))
+            break;
+        std::string imagePath(pathLength, '\0');
+        StoredPredictions entry;
+        if (!file.read(&imagePath[0], pathLength) || !readRaw(file, entry.imageSize)
+                || !readRaw(file, entry.imageMtimeNs) || !readRaw(file, numPredictions))
+            break;
+        entry.predictions.resize(numPredictions);
+        bool ok = true;
+        for (auto& p: entry.predictions)
+            ok = ok && readPrediction(file, p);
+        if (!ok)
+            break;
+        entries.emplace(std::move(imagePath), std::move(entry));
+    }
+    if (entries.size() != numEntries) {
+        LOG(ERROR) << path << " is truncated, ignoring it";
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_ = std::move(entries);
+    if (anyModel) {
+        modelFingerprint_ = fingerprint;
+        probFloor_ = floor;
+    }
+    return true;
+}
+
+bool PredictionStore::save(const std::string& path) const {
+    // write to temporary file first so that a crash doesn't leave half-written store
+    const std::string tmpPath = path + ".tmp";
+    {
+        std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            LOG(ERROR) << "can not write predictions to " << tmpPath;
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        file.write(kStoreMagic, sizeof(kStoreMagic));
+        writeRaw<uint32_t>(file, kStoreVersion);
+        writeRaw<uint64_t>(file, modelFingerprint_);
+        writeRaw<float>(file, probFloor_);
+        writeRaw<uint64_t>(file, entries_.size());
+        for (const auto& e: entries_) {
+            writeRaw<uint32_t>(file, e.first.size());
+            file.write(e.first.data(), e.first.size());
+            writeRaw<uint64_t>(file, e.second.imageSize);
+            writeRaw<int64_t>(file, e.second.imageMtimeNs);
+            writeRaw<uint32_t>(file, e.second.predictions.size());
+            for (const auto& p: e.second.predictions)
+                writePrediction(file, p);
+        }
+        if (!file.good()) {
+            LOG(ERROR) << "failed to write predictions to " << tmpPath;
+            return false;
+        }
+    }
+    return 0 == rename(tmpPath.c_str(), path.c_str());
+}
+
+const StoredPredictions* PredictionStore::find(const std::string& imagePath, uint64_t imageSize,
+                                               int64_t imageMtimeNs) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(imagePath);
+    if (entries_.end() == it || it->second.imageSize != imageSize || it->second.imageMtimeNs != imageMtimeNs)
+        return nullptr;
+    return &it->second;
+}
+
+const StoredPredictions* PredictionStore::find(const std::string& imagePath) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(imagePath);
+    return (entries_.end() == it) ? nullptr : &it->second;
+}
+
+std::vector<std::string> PredictionStore::imagePaths() const {
+    std::vector<std::string> paths;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        paths.reserve(entries_.size());
+        for (const auto& e: entries_)
+            paths.push_back(e.first);
+    }
+    std::sort(paths.begin(), paths.end());
+    return paths;
+}
+
+void PredictionStore::put(const std::string& imagePath, StoredPredictions entry) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_[imagePath] = std::move(entry);
+}
+
+size_t PredictionStore::size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+}
+
+uint64_t modelFingerprint(const std::string& configFile, const std::string& weightsFile) {
+    uint64_t cfgHash = fileContentsHash(configFile);
+    uint64_t weightsHash = fileContentsHash(weightsFile);
+    return fnv1aHash(&weightsHash, sizeof(weightsHash), cfgHash);
+}
@@ -0,0 +1,58 @@
+#ifndef PREDICTION_STORE_H
+#define PREDICTION_STORE_H
+
+#include <DarkHelp.hpp>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// raw network predictions for one image, with the state of the image file they were computed for
+struct StoredPredictions {
+    uint64_t imageSize = 0;
+    int64_t imageMtimeNs = 0;
+    DarkHelp::PredictionResults predictions;
+};
+
+// Persistent binary storage of raw predictions, keyed by image path (as written in train.txt, without .jpg).
+// Predictions are only valid for the model they were made with and for the probability threshold
+// they were filtered by, so both are kept in the file header.
+// put() and find() are thread-safe.
+class PredictionStore {
+public:
+    PredictionStore(uint64_t modelFingerprint, float probFloor);
+
+    // load store from file. Returns false if file can not be read or if it was made by another model
+    // or with higher probability threshold; then the store stays empty
+    bool load(const std::string& path);
+    // load file made by any model with any probability threshold; both are taken from the file (e.g. raw dump)
+    bool loadAny(const std::string& path);
+    // returns true if successful
+    bool save(const std::string& path) const;
+
+    // returns nullptr if there are no predictions for this version of the image
+    const StoredPredictions* find(const std::string& imagePath, uint64_t imageSize, int64_t imageMtimeNs) const;
+    // predictions for the image whatever state the image file is in now
+    const StoredPredictions* find(const std::string& imagePath) const;
+    void put(const std::string& imagePath, StoredPredictions entry);
+    // paths of all images in the store, sorted
+    std::vector<std::string> imagePaths() const;
+
+    size_t size() const;
+    uint64_t modelFingerprint() const {return modelFingerprint_;}
+    float probFloor() const {return probFloor_;}
+
+private:
+    bool loadFile(const std::string& path, bool anyModel);
+
+    uint64_t modelFingerprint_;
+    float probFloor_;
+    std::unordered_map<std::string, StoredPredictions> entries_;
+    mutable std::mutex mutex_;
+};
+
+// identifies the model: hash of .cfg and .weights file contents
+uint64_t modelFingerprint(const std::string& configFile, const std::string& weightsFile);
+
+#endif // PREDICTION_STORE_H
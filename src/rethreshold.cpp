@@ -0,0 +1,137 @@
+#include "rethreshold.h"
+#include "duv_io.h"
+#include "helpers.h"
+#include "parallel.h"
+#include "prediction_store.h"
+#include "validation.h"
+#include "easylogging++.h"
+#include <iterator>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+// grid of thresholds for sweepThresholds
+constexpr float kSweepProbMin = 0.05, kSweepProbMax = 0.9, kSweepProbStep = 0.05;
+constexpr float kSweepIouMin = 0.3, kSweepIouMax = 0.7, kSweepIouStep = 0.05;
+// images per parallelFor chunk
+constexpr size_t kImagesPerChunk = 16;
+
+// raw predictions with ground truth of the same images
+struct RawDataset {
+    PredictionStore store{0, 0};
+    std::vector<std::string> paths; // sorted
+    DatasetLabels labels;
+
+    ComparisonResults compare(size_t image, const ValidationThresholds& thresholds) const {
+        LoadedDetections groundTruthDets;
+        for (const LabelBox* box = labels.begin(image); box != labels.end(image); ++box)
+            groundTruthDets.push_back(LoadedDetection{box->classId, box->bbox, ""});
+        return comparePredictions(store.find(paths[image])->predictions, groundTruthDets, paths[image], thresholds);
+    }
+};
+
+static bool loadRawDataset(const std::string& pathToRawDump, RawDataset& dataset) {
+    if (!dataset.store.loadAny(pathToRawDump)) {
+        LOG(ERROR) << "Can\'t load raw predictions from " << pathToRawDump;
+        return false;
+    }
+    dataset.paths = dataset.store.imagePaths();
+    dataset.labels = loadDatasetLabels(dataset.paths);
+    LOG(INFO) << "Loaded raw predictions for " << dataset.paths.size() << " images and "
+              << dataset.labels.boxes.size() << " marks";
+    return true;
+}
+
+// predictions below the floor of the dump were not saved, so the results would miss them
+static void warnIfBelowFloor(const RawDataset& dataset, float probThresh) {
+    LOG_IF(probThresh < dataset.store.probFloor(), WARNING) << "probability threshold " << probThresh
+        << " is lower than " << dataset.store.probFloor() << " predictions were saved with; results are incomplete";
+}
+
+int rethresholdDuv(const std::string& pathToRawDump, const std::string& outputFile,
+                   const ValidationThresholds& thresholds) {
+    RawDataset dataset;
+    if (!loadRawDataset(pathToRawDump, dataset))
+        return -1;
+    warnIfBelowFloor(dataset, thresholds.prob);
+    std::vector<ComparisonResults> results(dataset.paths.size());
+    parallelFor(dataset.paths.size(), 0, kImagesPerChunk, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+            results[i] = dataset.compare(i, thresholds);
+    });
+    size_t numResults = 0;
+    if (isDuvBinaryPath(outputFile)) {
+        // thresholds go to the header, so cure uses the same ones
+        ComparisonResults all;
+        for (auto& rs: results)
+            all.insert(all.end(), std::make_move_iterator(rs.begin()), std::make_move_iterator(rs.end()));
+        numResults = all.size();
+        if (!saveDuvBinary(outputFile, all, DuvBinaryInfo{thresholds.prob, thresholds.iou,
+                                                          dataset.store.modelFingerprint()})) {
+            LOG(ERROR) << "failed to write " << outputFile;
+            return -1;
+        }
+    } else {
+        DuvWriter duvWriter(outputFile);
+        if (!duvWriter.isOpen()) {
+            LOG(ERROR) << "Can\'t write to file " << outputFile;
+            return -1;
+        }
+        for (const auto& rs: results) {
+            duvWriter.write(rs);
+            numResults += rs.size();
+        }
+        if (!duvWriter.flush()) {
+            LOG(ERROR) << "failed to write " << outputFile;
+            return -1;
+        }
+    }
+    LOG(INFO) << numResults << " results with prob threshold " << thresholds.prob << " and IoU threshold "
+              << thresholds.iou << " saved to " << outputFile;
+    LOG_IF(!isDuvBinaryPath(outputFile), INFO) << "run cure on it with --prob " << thresholds.prob
+                                               << " --iou " << thresholds.iou;
+    return 0;
+}
+
+int sweepThresholds(const std::string& pathToRawDump, const std::string& reportFile) {
+    RawDataset dataset;
+    if (!loadRawDataset(pathToRawDump, dataset))
+        return -1;
+    std::vector<ValidationThresholds> grid;
+    for (int p = 0; kSweepProbMin + p * kSweepProbStep <= kSweepProbMax + 1e-4; ++p)
+        for (int i = 0; kSweepIouMin + i * kSweepIouStep <= kSweepIouMax + 1e-4; ++i)
+            grid.push_back({kSweepProbMin + p * kSweepProbStep, kSweepIouMin + i * kSweepIouStep});
+    warnIfBelowFloor(dataset, kSweepProbMin);
+
+    // counts per grid point, summed over images
+    std::vector<size_t> toAdd(grid.size(), 0), toRemove(grid.size(), 0);
+    std::mutex countsMutex;
+    parallelFor(dataset.paths.size(), 0, kImagesPerChunk, [&](size_t begin, size_t end) {
+        std::vector<size_t> chunkToAdd(grid.size(), 0), chunkToRemove(grid.size(), 0);
+        for (size_t i = begin; i < end; ++i) {
+            for (size_t g = 0; g < grid.size(); ++g) {
+                for (const ComparisonResult& r: dataset.compare(i, grid[g])) {
+                    chunkToAdd[g] += r.isToAdd(grid[g]);
+                    chunkToRemove[g] += r.isToRemove(grid[g]);
+                }
+            }
+        }
+        std::lock_guard<std::mutex> lock(countsMutex);
+        for (size_t g = 0; g < grid.size(); ++g) {
+            toAdd[g] += chunkToAdd[g];
+            toRemove[g] += chunkToRemove[g];
+        }
+    });
+
+    std::ostringstream ss;
+    ss << "prob\tiou\ttoAdd\ttoRemove\n";
+    for (size_t g = 0; g < grid.size(); ++g)
+        ss << grid[g].prob << "\t" << grid[g].iou << "\t" << toAdd[g] << "\t" << toRemove[g] << "\n";
+    if (!saveToFile(reportFile, ss.str())) {
+        LOG(ERROR) << "Can\'t write to file " << reportFile;
+        return -1;
+    }
+    LOG(INFO) << "Counts of marks to add and to remove for " << grid.size() << " pairs of thresholds saved to "
+              << reportFile;
+    return 0;
+}
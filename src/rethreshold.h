@@ -0,0 +1,17 @@
+#ifndef RETHRESHOLD_H
+#define RETHRESHOLD_H
+
+#include "du_common.h"
+#include <string>
+
+// make .duv from raw predictions saved by "validate --rawdump" with other thresholds, without running the network.
+// Ground truth is read from .txt files next to the images; images are written in order of their paths.
+// Returns 0 on success
+int rethresholdDuv(const std::string& pathToRawDump, const std::string& outputFile,
+                   const ValidationThresholds& thresholds);
+
+// count .duv rows that cure would show as "to add" and "to remove" for a grid of probability and IoU thresholds,
+// save the table to reportFile (tab-separated: prob iou toAdd toRemove). Returns 0 on success
+int sweepThresholds(const std::string& pathToRawDump, const std::string& reportFile);
+
+#endif // RETHRESHOLD_H
@@ -0,0 +1,238 @@
+#include "sanity_check.h"
+#include "dataset_enum.h"
+#include "du_common.h"
+#include "helpers.h"
+#include "parallel.h"
+#include <easylogging++.h>
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <atomic>
+#include <fcntl.h>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+// files are checked in chunks of this size
+constexpr size_t kFilesPerChunk = 256;
+// EOI may be followed by a few padding bytes; look for it in this many last bytes of the file
+constexpr size_t kEoiSearchBytes = 32;
+
+// RAII file descriptor
+struct FileDescriptor {
+    int fd;
+    explicit FileDescriptor(const std::string& path) : fd(open(path.c_str(), O_RDONLY)) {}
+    ~FileDescriptor() {if (fd >= 0) close(fd);}
+};
+
+static bool readAt(int fd, off_t offset, unsigned char* buf, size_t size) {
+    return pread(fd, buf, size, offset) == ssize_t(size);
+}
+
+// markers that have no length field: TEM, RST0..RST7
+static bool isStandaloneMarker(unsigned char marker) {
+    return marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7);
+}
+
+// offset of EOI that ends image data starting at scanPos (just after the first SOS segment), or -1.
+// In entropy-coded data 0xFF is followed by 0 (stuffed byte), a restart marker or a fill byte, so any other marker
+// is either EOI or a segment between scans of a progressive image, which is skipped by its length
+static off_t findEoi(int fd, off_t scanPos, off_t fileSize) {
+    std::vector<unsigned char> data(fileSize - scanPos);
+    if (data.empty() || !readAt(fd, scanPos, data.data(), data.size()))
+        return -1;
+    size_t i = 0;
+    while (i + 1 < data.size()) {
+        if (data[i] != 0xFF) {
+            ++i;
+            continue;
+        }
+        const unsigned char marker = data[i + 1];
+        if (marker == 0xD9)
+            return scanPos + i;
+        if (marker == 0x00 || marker == 0xFF || isStandaloneMarker(marker)) {
+            i += (marker == 0xFF) ? 1 : 2;
+        } else {
+            if (i + 3 >= data.size())
+                return -1;
+            i += 2 + ((data[i + 2] << 8) | data[i + 3]);
+        }
+    }
+    return -1;
+}
+
+JpegHeaderInfo probeJpegHeader(const std::string& path) {
+    JpegHeaderInfo info;
+    FileDescriptor file(path);
+    struct stat st;
+    if (file.fd < 0 || fstat(file.fd, &st) != 0) {
+        info.error = "can not open";
+        return info;
+    }
+    const off_t fileSize = st.st_size;
+    unsigned char buf[9];
+    if (!readAt(file.fd, 0, buf, 2) || buf[0] != 0xFF || buf[1] != 0xD8) {
+        info.error = "not a JPEG (no SOI marker)";
+        return info;
+    }
+
+    // segments: FF, marker, 2-byte big-endian length (including itself), payload.
+    // Walk them up to SOS, image size is in the SOF segment before it
+    bool hasSof = false;
+    off_t pos = 2;
+    for (;;) {
+        if (!readAt(file.fd, pos, buf, 4)) {
+            info.error = hasSof ? "truncated before image data" : "truncated before SOF marker";
+            return info;
+        }
+        if (buf[0] != 0xFF) {
+            info.error = "bad marker at offset " + std::to_string(pos);
+            return info;
+        }
+        const unsigned char marker = buf[1];
+        if (marker == 0xFF) {
+            ++pos; // fill byte
+            continue;
+        }
+        if (isStandaloneMarker(marker)) {
+            pos += 2;
+            continue;
+        }
+        if (marker == 0xD9 || (marker == 0xDA && !hasSof)) {
+            info.error = hasSof ? "no image data" : "no SOF marker before image data";
+            return info;
+        }
+        const int length = (buf[2] << 8) | buf[3];
+        if (length < 2) {
+            info.error = "bad segment length at offset " + std::to_string(pos);
+            return info;
+        }
+        pos += 2 + length;
+        if (marker == 0xDA)
+            break;
+        // SOF0..SOF15 except DHT (C4), JPG (C8) and DAC (CC): precision, height, width
+        if (!hasSof && marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            if (!readAt(file.fd, pos - length + 2, buf, 5)) {
+                info.error = "truncated SOF segment";
+                return info;
+            }
+            info.height = (buf[1] << 8) | buf[2];
+            info.width = (buf[3] << 8) | buf[4];
+            hasSof = true;
+        }
+    }
+    if (info.width == 0 || info.height == 0) {
+        info.error = "zero image size in SOF segment";
+        return info;
+    }
+
+    // usually the file ends with EOI, maybe followed by a few padding bytes
+    unsigned char tail[kEoiSearchBytes];
+    const size_t tailSize = std::min<off_t>(kEoiSearchBytes, fileSize - pos);
+    bool hasEoi = tailSize > 0 && readAt(file.fd, fileSize - tailSize, tail, tailSize);
+    if (hasEoi) {
+        hasEoi = false;
+        for (size_t i = 0; i + 1 < tailSize && !hasEoi; ++i)
+            hasEoi = (tail[i] == 0xFF && tail[i + 1] == 0xD9);
+    }
+    if (hasEoi)
+        return info;
+    // otherwise image data is cut off, or the file has something appended after EOI (e.g. a camera trailer)
+    const off_t eoiPos = findEoi(file.fd, pos, fileSize);
+    if (eoiPos < 0)
+        info.error = "truncated (no EOI marker after image data)";
+    else
+        info.bytesAfterEoi = fileSize - eoiPos - 2;
+    return info;
+}
+
+// problems found in files of one image, as report lines
+static void checkImage(const std::string& pathWithoutExt, bool hasTxt, bool decode, std::ostringstream& report) {
+    const std::string imgPath = pathWithoutExt + ".jpg";
+    const JpegHeaderInfo header = probeJpegHeader(imgPath);
+    if (header.bytesAfterEoi > 0)
+        report << imgPath << '\t' << header.bytesAfterEoi << " bytes of data after EOI marker\n";
+    if (!header.error.empty()) {
+        report << imgPath << '\t' << header.error << '\n';
+    } else if (decode) {
+        // header has the stored size; rotating by EXIF orientation would swap width and height of phone photos
+        cv::Mat img = cv::imread(imgPath, cv::IMREAD_COLOR | cv::IMREAD_IGNORE_ORIENTATION);
+        if (nullptr == img.data)
+            report << imgPath << "\tfailed to decode\n";
+        else if (img.cols != header.width || img.rows != header.height)
+            report << imgPath << "\tdecoded size " << img.cols << "x" << img.rows << " differs from header "
+                   << header.width << "x" << header.height << '\n';
+    }
+
+    if (!hasTxt)
+        return;
+    const std::string txtPath = pathWithoutExt + ".txt";
+    std::vector<LabelBox> boxes;
+    const size_t numBadLines = parseDarknetLabels(getFileContents(txtPath), boxes, txtPath);
+    if (numBadLines > 0)
+        report << txtPath << '\t' << numBadLines << " lines can not be parsed\n";
+    LoadedDetections dets;
+    dets.reserve(boxes.size());
+    const std::string filename = extractFilenameFromFullPath(txtPath);
+    for (const LabelBox& b: boxes)
+        dets.push_back(LoadedDetection{b.classId, b.bbox, filename});
+    for (const LoadedDetection& d: dets) {
+        if (!d.isValid())
+            report << txtPath << "\tinvalid mark " << d.toHumanString() << '\n';
+    }
+    for (const auto& pair: findOverlappingPairs(dets)) {
+        report << txtPath << "\tmarks " << pair.first << " and " << pair.second << " are probably the same object: "
+               << dets[pair.first].toHumanString() << ", " << dets[pair.second].toHumanString() << '\n';
+    }
+}
+
+int sanityCheck(const std::string& pathToDataset, const std::string& reportFile, const SanityCheckOptions& options) {
+    const std::string path = addSlash(pathToDataset);
+    const DatasetDirListing listing = listDatasetDir(path);
+
+    struct ImageFiles {
+        std::string_view baseName;
+        bool hasTxt;
+    };
+    std::vector<ImageFiles> images;
+    images.reserve(listing.labeled.size() + listing.unlabeled.size());
+    std::ostringstream report;
+    for (std::string_view name: listing.otherFiles)
+        report << path << name << "\textra file\n";
+    for (std::string_view baseName: listing.orphanLabels)
+        report << path << baseName << ".txt\torphan labels, no .jpg\n";
+    for (std::string_view baseName: listing.unlabeled) {
+        report << path << baseName << ".jpg\tno .txt labels\n";
+        images.push_back({baseName, false});
+    }
+    for (std::string_view baseName: listing.labeled)
+        images.push_back({baseName, true});
+    std::inplace_merge(images.begin(), images.begin() + listing.unlabeled.size(), images.end(),
+                       [](const ImageFiles& a, const ImageFiles& b) {return a.baseName < b.baseName;});
+    LOG(INFO) << "checking " << images.size() << " images in " << path << (options.decode ? " (decoding)" : "");
+
+    // every chunk writes its own part of the report, parts are joined in order
+    const size_t numChunks = (images.size() + kFilesPerChunk - 1) / kFilesPerChunk;
+    std::vector<std::string> chunkReports(numChunks);
+    std::atomic<size_t> numChecked{0};
+    parallelFor(images.size(), options.numThreads, kFilesPerChunk, [&](size_t begin, size_t end) {
+        std::ostringstream chunkReport;
+        for (size_t i = begin; i < end; ++i)
+            checkImage(path + std::string(images[i].baseName), images[i].hasTxt, options.decode, chunkReport);
+        chunkReports[begin / kFilesPerChunk] = chunkReport.str();
+        const size_t done = (numChecked += end - begin);
+        LOG_IF(done / 100000 != (done - (end - begin)) / 100000, INFO) << done << "/" << images.size() << " images checked";
+    });
+    for (const std::string& r: chunkReports)
+        report << r;
+    const std::string reportStr = report.str();
+    const size_t numProblems = std::count(reportStr.begin(), reportStr.end(), '\n');
+
+    if (!saveToFile(reportFile, reportStr)) {
+        LOG(ERROR) << "failed to save report to " << reportFile;
+        return -1;
+    }
+    LOG_IF(numProblems == 0, INFO) << "no problems found in " << images.size() << " images";
+    LOG_IF(numProblems > 0, WARNING) << numProblems << " problems found in " << path << ", see " << reportFile;
+    return (numProblems == 0) ? 0 : -1;
+}
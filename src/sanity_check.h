@@ -0,0 +1,36 @@
+#ifndef SANITY_CHECK_H
+#define SANITY_CHECK_H
+
+#include <cstddef>
+#include <string>
+
+// what can be told about a .jpg file from its markers, without decoding it
+struct JpegHeaderInfo {
+    int width = 0;
+    int height = 0;
+    // empty if the file looks like a complete JPEG
+    std::string error;
+    // size of data appended after EOI marker; decoders ignore it, but it's not part of the image
+    size_t bytesAfterEoi = 0;
+};
+
+// walk JPEG markers from SOI to the first SOS segment to get image size, and check that image data ends with EOI
+// (so it's not truncated). Reads only a few bytes per segment and the end of file; the whole image data is only read
+// if EOI is not at the end of file
+JpegHeaderInfo probeJpegHeader(const std::string& path);
+
+struct SanityCheckOptions {
+    // also decode every image with OpenCV; finds corrupt data inside files with valid headers, but is much slower
+    bool decode = false;
+    // 0 = all cores
+    unsigned numThreads = 0;
+};
+
+// check dataset folder: every .jpg has .txt and vice versa, no other files, images have valid headers,
+// labels are parsed without errors, marks are valid (LoadedDetection::isValid) and no object is marked twice.
+// Problems are saved to reportFile, one per line: path, tab, description.
+// Returns 0 if no problems were found
+int sanityCheck(const std::string& pathToDataset, const std::string& reportFile,
+                const SanityCheckOptions& options = SanityCheckOptions());
+
+#endif // SANITY_CHECK_H
@@ -0,0 +1,94 @@
+#include "tracker.h"
+#include "cv_funcs.h"
+#include <algorithm>
+#include <cmath>
+
+// corner points looked for inside each box
+constexpr int kMaxPointsPerBox = 12;
+// boxes smaller than this (pixels) are too small to find corners in
+constexpr int kMinBoxSide = 6;
+
+static float median(std::vector<float>& v) {
+    std::nth_element(v.begin(), v.begin() + v.size() / 2, v.end());
+    return v[v.size() / 2];
+}
+
+static cv::Mat toGray(const cv::Mat& frame) {
+    if (frame.channels() == 1)
+        return frame;
+    cv::Mat gray;
+    cv::cvtColor(frame, gray, cv::COLOR_BGR2GRAY);
+    return gray;
+}
+
+void BoxTracker::reset(const cv::Mat& frame, const DarkHelp::PredictionResults& predictions) {
+    prevGray_ = toGray(frame);
+    boxes_ = predictions;
+}
+
+const DarkHelp::PredictionResults& BoxTracker::update(const cv::Mat& frame) {
+    cv::Mat gray = toGray(frame);
+    if (boxes_.empty() || prevGray_.size() != gray.size()) {
+        prevGray_ = gray;
+        return boxes_;
+    }
+    // corners of all boxes go to optical flow at once; pointBox[k] is index of the box of point k
+    std::vector<cv::Point2f> points, nextPoints, boxPoints;
+    std::vector<int> pointBox;
+    const cv::Rect frameRect(0, 0, gray.cols, gray.rows);
+    for (size_t b = 0; b < boxes_.size(); ++b) {
+        const cv::Rect roi = boxes_[b].rect & frameRect;
+        if (roi.width < kMinBoxSide || roi.height < kMinBoxSide)
+            continue;
+        cv::goodFeaturesToTrack(prevGray_(roi), boxPoints, kMaxPointsPerBox, 0.01, 3);
+        for (const auto& p: boxPoints) {
+            points.emplace_back(p.x + roi.x, p.y + roi.y);
+            pointBox.push_back(b);
+        }
+    }
+    if (!points.empty()) {
+        std::vector<unsigned char> status;
+        std::vector<float> err;
+        cv::calcOpticalFlowPyrLK(prevGray_, gray, points, nextPoints, status, err);
+        std::vector<std::vector<float>> dx(boxes_.size()), dy(boxes_.size());
+        for (size_t k = 0; k < points.size() && k < nextPoints.size() && k < status.size(); ++k) {
+            if (status[k]) {
+                dx[pointBox[k]].push_back(nextPoints[k].x - points[k].x);
+                dy[pointBox[k]].push_back(nextPoints[k].y - points[k].y);
+            }
+        }
+        for (size_t b = 0; b < boxes_.size(); ++b) {
+            if (dx[b].empty())
+                continue;
+            // median is robust to points on background that got into the box
+            const float shiftX = median(dx[b]), shiftY = median(dy[b]);
+            auto& box = boxes_[b];
+            box.rect.x += int(std::lround(shiftX));
+            box.rect.y += int(std::lround(shiftY));
+            box.original_point.x += shiftX / gray.cols;
+            box.original_point.y += shiftY / gray.rows;
+        }
+    }
+    prevGray_ = gray;
+    return boxes_;
+}
+
+KeyframeSelector::KeyframeSelector(int interval, float motionThresh)
+    : interval_(std::max(1, interval)), motionThresh_(motionThresh) {}
+
+bool KeyframeSelector::isKeyframe(const cv::Mat& frame) {
+    ++framesSinceKeyframe_;
+    bool keyframe = (framesSinceKeyframe_ == 0 || framesSinceKeyframe_ >= interval_);
+    cv::Mat small;
+    if (!keyframe && motionThresh_ > 0) {
+        small = similarityThumbnail(frame);
+        // stops summing as soon as the frame is known to be a keyframe
+        keyframe = thumbnailDiff(lastKeyframe_, small, motionThresh_) > motionThresh_;
+    }
+    if (keyframe) {
+        framesSinceKeyframe_ = 0;
+        if (motionThresh_ > 0)
+            lastKeyframe_ = small.empty() ? similarityThumbnail(frame) : small;
+    }
+    return keyframe;
+}
@@ -0,0 +1,38 @@
+#ifndef TRACKER_H
+#define TRACKER_H
+
+#include <DarkHelp.hpp>
+#include <opencv2/opencv.hpp>
+
+// Moves predictions made on a keyframe along with the image content on the following frames, so the network
+// doesn't have to run on every frame. Each box is shifted by the median optical flow (pyramidal Lucas-Kanade)
+// of corner points found inside it; a box without trackable points stays in place.
+// Box sizes don't change between keyframes
+class BoxTracker {
+public:
+    // start tracking predictions made on this frame
+    void reset(const cv::Mat& frame, const DarkHelp::PredictionResults& predictions);
+    // move boxes to the next frame and return them
+    const DarkHelp::PredictionResults& update(const cv::Mat& frame);
+
+private:
+    cv::Mat prevGray_;
+    DarkHelp::PredictionResults boxes_;
+};
+
+// keyframe selection for markvid: the network runs on every interval-th frame, and also on frames that differ
+// from the last keyframe by more than motionThresh (thumbnailDiff; 0 = don't check motion)
+class KeyframeSelector {
+public:
+    KeyframeSelector(int interval, float motionThresh);
+    // true if the network should run on this frame. Call for every frame in order
+    bool isKeyframe(const cv::Mat& frame);
+
+private:
+    int interval_;
+    float motionThresh_;
+    int framesSinceKeyframe_ = -1;
+    cv::Mat lastKeyframe_; // similarityThumbnail
+};
+
+#endif // TRACKER_H
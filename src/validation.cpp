@@ -1,112 +1,281 @@
 #include "validation.h"
 #include "du_common.h"
 #include "helpers.h"
+#include "bounded_queue.h"
+#include "box_matching.h"
+#include "duv_io.h"
+#include "prediction_store.h"
+#include "evaluation.h"
+#include "detector.h"
+#include "dataset_enum.h"
 #include "easylogging++.h"
 #include <DarkHelp.hpp>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
 #include <string>
+#include <thread>
 #include <vector>
 using namespace std;
 using namespace cv;
 
-// forward decl
-ComparisonResults comparePredictions(cv::Mat img, const DarkHelp::PredictionResults& predictions,
-                                     const vector<LoadedDetection>& groundTruthDets, const std::string& filename);
+// image with its ground truth marks, loaded by decoder threads ahead of inference
+struct ValidationItem {
+    size_t index; // index in the list of images; results are written in this order
+    std::string filename;
+    bool loaded = false; // false if image failed to load
+    uint64_t imageSize = 0;
+    int64_t imageMtimeNs = 0;
+    cv::Mat img; // not decoded if predictions are taken from cache
+    const StoredPredictions* cached = nullptr;
+    LoadedDetections groundTruthDets;
+};
+
+// comparison results for one image, waiting to be written to .duv
+struct ValidationOutput {
+    size_t index;
+    ComparisonResults results;
+};
+
+// how many images are decoded ahead of inference, per inference worker
+constexpr size_t kPrefetchPerWorker = 8;
+// how many compared images may wait for the writer thread
+constexpr size_t kWriteQueueSize = 64;
+
+// number of threads decoding images and label files
+static unsigned numDecoderThreads(unsigned numWorkers) {
+    const unsigned hwThreads = std::max(2u, std::thread::hardware_concurrency());
+    return std::max(2u, std::min(hwThreads, (numWorkers + 1) / 2));
+}
 
 void validateDataset(std::string pathToTrainList, const std::string& configFile, const std::string& weightsFile,
-            const std::string& namesFile, const std::string outputFile) {
+            const std::string& namesFile, const std::string outputFile, const ValidationOptions& options) {
+
+    // with raw dump or metrics report, the network keeps predictions down to kRawDumpProbFloor, since AP and
+    // PR curves need the low-score ones too; comparePredictions still only looks at the ones above kValidationProbThresh
+    const bool rawDump = !options.rawDumpPath.empty();
+    const float probFloor = (rawDump || !options.reportPath.empty()) ? kRawDumpProbFloor : kValidationProbThresh;
 
-    vector<string> imagesPaths = loadPathsToImages(pathToTrainList);
+    // millions of paths are kept in a few large blocks rather than one string each
+    PathArena pathArena;
+    const vector<std::string_view> imagesPaths = loadPathsToImages(pathToTrainList, pathArena);
     LOG_IF(imagesPaths.empty(), FATAL) << "Can\'t load train images from " << namesFile;
-    bool writable = saveToFile(outputFile, "", false);
-    LOG_IF(!writable, FATAL) << "Can\'t write to file " << outputFile;
-
-    DarkHelp darkhelp(configFile, weightsFile, namesFile);
-
-    darkhelp.threshold                      = kValidationProbThresh;
-    darkhelp.include_all_names              = false;
-    darkhelp.names_include_percentage       = true;
-    darkhelp.annotation_include_duration    = false;
-    darkhelp.annotation_include_timestamp   = false;
-    darkhelp.sort_predictions               = DarkHelp::ESort::kAscending;
-
-    std::string result;
-    // .duv format: one file for all images&detections, each detection on separate line, sorted by files. Each line:
-    // class x y w h percent IoU image name with spaces.jpg
-    for (size_t filesIndex = 0; filesIndex < imagesPaths.size(); ++filesIndex) {
-        const string filename = imagesPaths[filesIndex];
-        string pathToImage = filename + ".jpg";
-        cv::Mat img = imread(pathToImage);
-        if (nullptr == img.data || img.cols < 1 || img.rows < 1) {
-            LOG(ERROR) << "failed to load image: " << pathToImage;
-            continue;
+    DuvWriter duvWriter(outputFile);
+    LOG_IF(!duvWriter.isOpen(), FATAL) << "Can\'t write to file " << outputFile;
+
+    // each worker owns a network instance; they're loaded one by one before any inference starts
+    const unsigned numWorkers = std::max(1u, options.numWorkers);
+    const size_t batchSize = std::max(1u, options.detector.batchSize);
+    std::vector<std::unique_ptr<Detector>> detectors;
+    for (unsigned w = 0; w < numWorkers; ++w)
+        detectors.push_back(createDetector(options.detector.backend, configFile, weightsFile, namesFile, probFloor));
+    LOG_IF(numWorkers > 1, INFO) << "Loaded " << numWorkers << " network instances";
+
+    // predictions from previous runs with the same model are reused for unchanged images.
+    // The updated cache only keeps images of this run; it's also what goes to the raw dump
+    const std::string cachePath = options.cachePath.empty() ? (outputFile + ".cache") : options.cachePath;
+    const uint64_t fingerprint = (options.useCache || rawDump) ? detectors.front()->fingerprint() : 0;
+    PredictionStore cache(fingerprint, probFloor);
+    PredictionStore updatedCache(fingerprint, probFloor);
+    if (options.useCache && cache.load(cachePath))
+        LOG(INFO) << "Loaded " << cache.size() << " cached predictions from " << cachePath;
+
+    // metrics are accumulated as images are compared, in the same pass
+    std::unique_ptr<DetectionEvaluator> evaluator;
+    if (!options.reportPath.empty())
+        evaluator.reset(new DetectionEvaluator(getFileContentsAsStringVector(namesFile)));
+
+    // pipeline: decoder threads -> inference workers -> writer thread.
+    // Workers take the next decoded image from the shared queue as soon as they're free, so a slow image
+    // doesn't hold the others back. Results come out of order, the writer puts them back in the order of train.txt
+    BoundedQueue<ValidationItem> decodedQueue(std::max(kPrefetchPerWorker, 2 * batchSize) * numWorkers);
+    BoundedQueue<ValidationOutput> writeQueue(kWriteQueueSize);
+
+    std::atomic<size_t> nextToDecode{0};
+    const unsigned numDecoders = numDecoderThreads(numWorkers);
+    std::atomic<unsigned> activeDecoders{numDecoders};
+    std::vector<std::thread> decoders;
+    for (unsigned t = 0; t < numDecoders; ++t) {
+        decoders.emplace_back([&] {
+            for (size_t i = nextToDecode++; i < imagesPaths.size(); i = nextToDecode++) {
+                ValidationItem item;
+                item.index = i;
+                item.filename = std::string(imagesPaths[i]);
+                string pathToImage = item.filename + ".jpg";
+                if (getFileSizeAndMtime(pathToImage, item.imageSize, item.imageMtimeNs))
+                    item.cached = cache.find(item.filename, item.imageSize, item.imageMtimeNs);
+                if (nullptr == item.cached)
+                    item.img = imread(pathToImage);
+                item.loaded = (nullptr != item.cached || (nullptr != item.img.data && item.img.cols > 0 && item.img.rows > 0));
+                if (item.loaded)
+                    item.groundTruthDets = loadedDetectionsFromFile(item.filename + ".txt");
+                else
+                    LOG(ERROR) << "failed to load image: " << pathToImage;
+                if (!decodedQueue.push(std::move(item)))
+                    break;
+            }
+            if (--activeDecoders == 0)
+                decodedQueue.close();
+        });
+    }
+
+    size_t numResultsSaved = 0;
+    std::thread writer([&] {
+        // .duv format: one file for all images&detections, each detection on separate line, sorted by files. Each line:
+        // class x y w h percent IoU image name with spaces.jpg
+        std::map<size_t, ComparisonResults> pending;
+        size_t nextToWrite = 0;
+        ValidationOutput output;
+        while (writeQueue.pop(output)) {
+            pending.emplace(output.index, std::move(output.results));
+            for (auto it = pending.begin(); it != pending.end() && it->first == nextToWrite; it = pending.begin()) {
+                duvWriter.write(it->second);
+                numResultsSaved += it->second.size();
+                pending.erase(it);
+                ++nextToWrite;
+            }
         }
-        vector<LoadedDetection> groundTruthDets = loadedDetectionsFromFile(imagesPaths[filesIndex] + ".txt");
-        const DarkHelp::PredictionResults predictions = darkhelp.predict(img);
-        LOG(INFO) << (filesIndex+1) << "/" << imagesPaths.size() << " " << filename
-                    << ".jpg: " << groundTruthDets.size() << " marks"
-                    << (groundTruthDets.size() == predictions.size() ? " and " : " but ")
-                    << predictions.size() << " predictions";
-        ComparisonResults results = comparePredictions(img, predictions, groundTruthDets, filename);
-        saveToFile(outputFile, to_string(results), true); // append
+        duvWriter.flush();
+    });
 
+    std::atomic<size_t> numImagesDone{0}, numImagesCached{0};
+    std::atomic<unsigned> activeWorkers{numWorkers};
+    std::vector<std::thread> workers;
+    for (unsigned w = 0; w < numWorkers; ++w) {
+        workers.emplace_back([&, w] {
+            Detector& detector = *detectors[w];
+            // worker takes up to batchSize decoded images at once; those not found in cache go to the network together
+            std::vector<ValidationItem> batch;
+            std::vector<cv::Mat> images;
+            while (decodedQueue.popBatch(batch, batchSize)) {
+                images.clear();
+                for (const ValidationItem& item: batch) {
+                    if (item.loaded && nullptr == item.cached)
+                        images.push_back(item.img);
+                }
+                std::vector<DarkHelp::PredictionResults> batchPredictions = detector.predictBatch(images);
+                auto nextPredictions = batchPredictions.begin();
+                for (ValidationItem& item: batch) {
+                    ValidationOutput output{item.index, {}};
+                    if (item.loaded) {
+                        StoredPredictions entry{item.imageSize, item.imageMtimeNs, {}};
+                        entry.predictions = item.cached ? item.cached->predictions : std::move(*nextPredictions++);
+                        const DarkHelp::PredictionResults& predictions = entry.predictions;
+                        numImagesCached += (nullptr != item.cached);
+                        LOG(INFO) << (++numImagesDone) << "/" << imagesPaths.size() << " " << item.filename
+                                    << ".jpg: " << item.groundTruthDets.size() << " marks"
+                                    << (item.groundTruthDets.size() == predictions.size() ? " and " : " but ")
+                                    << predictions.size() << " predictions" << (item.cached ? " (cached)" : "");
+                        output.results = comparePredictions(predictions, item.groundTruthDets, item.filename);
+                        if (evaluator)
+                            evaluator->addImage(predictions, item.groundTruthDets);
+                        if (options.useCache || rawDump)
+                            updatedCache.put(item.filename, std::move(entry));
+                    }
+                    writeQueue.push(std::move(output));
+                }
+            }
+            if (--activeWorkers == 0)
+                writeQueue.close();
+        });
     }
-    LOG(INFO) << "ValidateDataset finished. Results saved to " << outputFile; // TODO how many results?
+
+    for (auto& w: workers)
+        w.join();
+    for (auto& d: decoders)
+        d.join();
+    writer.join();
+    if (options.useCache) {
+        bool cacheSaved = updatedCache.save(cachePath);
+        LOG_IF(cacheSaved, INFO) << "Predictions for " << updatedCache.size() << " images cached in " << cachePath
+                                 << ", " << numImagesCached << " of them were reused from the previous run";
+        LOG_IF(!cacheSaved, ERROR) << "failed to save predictions cache to " << cachePath;
+    }
+    if (rawDump) {
+        bool dumpSaved = updatedCache.save(options.rawDumpPath);
+        LOG_IF(dumpSaved, INFO) << "Raw predictions with prob > " << probFloor << " saved to " << options.rawDumpPath;
+        LOG_IF(!dumpSaved, ERROR) << "failed to save raw predictions to " << options.rawDumpPath;
+    }
+    if (evaluator) {
+        const std::string report = evaluator->report();
+        LOG_IF(!saveToFile(options.reportPath, report), ERROR) << "failed to save report to " << options.reportPath;
+        LOG(INFO) << "mAP@0.5 = " << evaluator->meanAveragePrecision(0) << ", full report saved to " << options.reportPath;
+    }
+    LOG(INFO) << "ValidateDataset finished. " << numResultsSaved << " results saved to " << outputFile;
 }
 
-ComparisonResults comparePredictions(cv::Mat img, const DarkHelp::PredictionResults& predictions,
-                                     const vector<LoadedDetection>& groundTruthDets, const std::string& filename) {
+ComparisonResults comparePredictions(const DarkHelp::PredictionResults& predictions,
+                                     const LoadedDetections& groundTruthDets, const std::string& filename,
+                                     const ValidationThresholds& thresholds) {
     constexpr bool verbose = false;
     ComparisonResults results;
 
-    // identifying false negatives: loaded ground truth detections that have no intercections with dets
-    for (const LoadedDetection& loadedDet: groundTruthDets) {
-        // find detections of the same class, see what intersects.
-        float classProbability = -1;
-        // iterate through darknet predictions to see if they match ground truth
-        for (int i = 0; i < predictions.size(); ++i) {
-            auto predictionBbox = relativeBbox(predictions[i]);
-            float p = getProb(predictions[i], loadedDet.classId);
-            float iou = intersectionOverUnion(predictionBbox, loadedDet.bbox);
-            if (p > kValidationProbThresh && iou > kStrongIntersectionThresh) {
-                classProbability = p;
-                results.push_back({loadedDet.classId, predictionBbox, p, iou, filename});
-                LOG_IF(verbose, INFO) << "detected OK " << predictions[i];
-                break;
-            }
+    // overlapping pairs of predictions and ground truth marks with their iou, found once for all classes.
+    // Pairs that don't intersect have iou = 0 and can't change any of the results
+    BoxesSoA predBoxes, gtBoxes;
+    predBoxes.reserve(predictions.size());
+    gtBoxes.reserve(groundTruthDets.size());
+    for (const auto& prediction: predictions)
+        predBoxes.push_back(relativeBbox(prediction));
+    for (const LoadedDetection& loadedDet: groundTruthDets)
+        gtBoxes.push_back(loadedDet.bbox);
+    const std::vector<BoxMatch> pairs = overlappingPairs(predBoxes, gtBoxes);
+    const size_t numGts = groundTruthDets.size();
+
+    // identifying false negatives: each ground truth mark is matched with at most one prediction of its class
+    // and vice versa, most confident predictions first
+    std::vector<BoxMatch> candidates;
+    for (const BoxMatch& pair: pairs) {
+        if (pair.iou > thresholds.iou) {
+            float p = getProb(predictions[pair.pred], groundTruthDets[pair.gt].classId);
+            if (p > thresholds.prob)
+                candidates.push_back({pair.pred, pair.gt, p, pair.iou});
         }
-        // no matching detection for this "ground truth" loadedDet
-        if (classProbability < 0) {
+    }
+    std::vector<BoxMatch> matches = greedyOneToOneMatch(std::move(candidates), predictions.size(), numGts);
+    std::vector<int> matchOfGt(numGts, -1);
+    for (size_t m = 0; m < matches.size(); ++m)
+        matchOfGt[matches[m].gt] = m;
+    for (size_t g = 0; g < numGts; ++g) {
+        const LoadedDetection& loadedDet = groundTruthDets[g];
+        if (matchOfGt[g] >= 0) {
+            const BoxMatch& match = matches[matchOfGt[g]];
+            results.push_back({loadedDet.classId, relativeBbox(predictions[match.pred]), match.score, match.iou, filename});
+            LOG_IF(verbose, INFO) << "detected OK " << predictions[match.pred];
+        } else {
             // loadedDet hasn't been detected
             LOG_IF(verbose, WARNING) << "Darknet doesn\'t see this ground truth detection: " << loadedDet.toHumanString();
             results.push_back({loadedDet.classId, loadedDet.bbox, 0, 0, filename});
         }
     }
-    // then look for false positives: find detections from *dets that do not intersect with ground truth
+    // then look for false positives: predictions that do not intersect with ground truth of the same class
+    auto predPairs = pairs.begin(); // pairs are sorted by prediction
     for (int i = 0; i < predictions.size(); ++i) {
+        auto predPairsEnd = std::find_if(predPairs, pairs.end(), [i](const BoxMatch& pair) {return pair.pred != i;});
         for (auto it = predictions[i].all_probabilities.cbegin(); it != predictions[i].all_probabilities.cend(); ++it) {
             int classId = it->first;
             float detectionProb = it->second;
-            auto predictionBbox = relativeBbox(predictions[i]);
-            if (detectionProb > kValidationProbThresh) {
-                // see if dets[i] intersect with some of ground truth detections. If not, this is a false positive
+            if (detectionProb > thresholds.prob) {
                 bool hasMatchingGtDet = false;
                 float maxClassIou = 0; // maximum iou between darknet prediction and any of ground_truth with this classId
-                for (const LoadedDetection& loadedDet: groundTruthDets) {
-                    if (classId == loadedDet.classId) {
-                        maxClassIou = std::max(maxClassIou, intersectionOverUnion(predictionBbox, loadedDet.bbox));
-                        if (maxClassIou >= kStrongIntersectionThresh) {
+                for (auto pair = predPairs; pair != predPairsEnd; ++pair) {
+                    if (classId == groundTruthDets[pair->gt].classId) {
+                        maxClassIou = std::max(maxClassIou, pair->iou);
+                        if (maxClassIou >= thresholds.iou) {
                             hasMatchingGtDet = true; // nothing to add to results, this det was added on the last step
                             break;
                         }
                     }
                 }
                 if (!hasMatchingGtDet) {
-                    results.push_back({classId, predictionBbox, detectionProb, maxClassIou, filename});
+                    results.push_back({classId, relativeBbox(predictions[i]), detectionProb, maxClassIou, filename});
                     LOG_IF(verbose, WARNING) << "detection predicted by darknet " << results.back().toString()
                         << " does not have corresponding groundTruth mark (max iou = " << maxClassIou << ")";
                 }
             }
         } // classId
+        predPairs = predPairsEnd;
     } // i = index of detection
     return results;
 }
@@ -1,15 +1,45 @@
 #ifndef VALIDATION_H
 #define VALIDATION_H
 
+#include "du_common.h"
+#include "detector.h"
 #include <string>
 
+// probability threshold of predictions kept in raw dump
+constexpr float kRawDumpProbFloor = 0.005;
+
+struct ValidationOptions {
+    // number of network instances running inference in parallel, each in its own thread
+    unsigned numWorkers = 1;
+    // reuse raw predictions of unchanged images from previous runs with the same .cfg and .weights
+    bool useCache = true;
+    // file with cached predictions; if empty, outputFile + ".cache" is used
+    std::string cachePath;
+    // if not empty, detection metrics (mAP, precision-recall, confusion matrix) are saved to this file
+    std::string reportPath;
+    // if not empty, all predictions with prob > kRawDumpProbFloor are saved to this file (PredictionStore format),
+    // to make .duv with other thresholds by rethreshold command without running the network again
+    std::string rawDumpPath;
+    // backend and how many decoded images each worker passes to it at once
+    DetectorOptions detector;
+};
+
 // checks all dataset images with trained model, output info about detections and IoUs to file
 // pathToTrainList - path/to/train.txt with images list. Paths are relative to train.txt itself
 // param outputFile - /path/to/output.duv - path to darkUtilsValidation-format file
 // .duv format: one file for all images&detections, each detection on separate line, sorted by files. Each line:
 // class x y w h percent IoU image name with spaces.jpg
 void validateDataset(std::string pathToTrainList, const std::string& configFile, const std::string& weightsFile,
-            const std::string& namesFile, const std::string outputFile);
+            const std::string& namesFile, const std::string outputFile,
+            const ValidationOptions& options = ValidationOptions());
 
+// compare network predictions for one image with its ground truth marks. Results contain
+// - every ground truth mark: with the prediction matched to it (prob, iou), or with prob = iou = 0 if it wasn't detected.
+//   Marks and predictions are matched one-to-one, the most confident predictions first
+// - predictions with prob > thresholds.prob that don't overlap any mark of the same class, with their max iou
+// Predictions count as detecting a mark if iou > thresholds.iou
+ComparisonResults comparePredictions(const DarkHelp::PredictionResults& predictions,
+                                     const LoadedDetections& groundTruthDets, const std::string& filename,
+                                     const ValidationThresholds& thresholds = ValidationThresholds());
 
 #endif // VALIDATION_H